@@ -0,0 +1,213 @@
+#ifndef _ARENA_
+#define _ARENA_
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h> // _aligned_malloc ()
+
+#include "util.h"
+
+#define ARENA_ALIGN 16
+
+#define KILOBYTES(__n) ((size_t) (__n) << 10)
+#define MEGABYTES(__n) ((size_t) (__n) << 20)
+
+/*
+ * Every heap allocation made by the game (and by Box2D, see b2SetAllocator)
+ * goes through heap_alloc () so we can tell when the steady state isn't.
+ */
+struct alloc_stats
+{
+    u64 allocs;
+    u64 frees;
+    u64 bytes;
+};
+
+static struct alloc_stats alloc_stats;
+
+static void *
+heap_alloc (size_t size, size_t align)
+{
+    void *ptr = _aligned_malloc (size, align);
+
+    if (ptr)
+    {
+        alloc_stats.allocs++;
+        alloc_stats.bytes += size;
+    }
+
+    return ptr;
+}
+
+static void
+heap_free (void *ptr)
+{
+    if (ptr)
+    {
+        alloc_stats.frees++;
+        _aligned_free (ptr);
+    }
+}
+
+/*
+ * Linear allocator. Everything pushed is released at once by arena_reset ().
+ */
+struct arena
+{
+    u8 *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+    bool owned;
+};
+
+static void
+arena_init (struct arena *arena, size_t size)
+{
+    arena->base = heap_alloc (size, 64);
+    arena->size = size;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->owned = true;
+
+    ASSERT (arena->base);
+}
+
+static void *
+arena_push (struct arena *arena, size_t size)
+{
+    size_t offset = (arena->used + (ARENA_ALIGN - 1)) & ~(size_t) (ARENA_ALIGN - 1);
+    void *ptr = NULL;
+
+    if (offset + size <= arena->size)
+    {
+        ptr = arena->base + offset;
+        arena->used = offset + size;
+        arena->high_water = MAX (arena->high_water, arena->used);
+        memset (ptr, 0, size);
+    }
+
+    return ptr;
+}
+
+#define ARENA_PUSH_ARRAY(__arena, __type, __count) \
+    ((__type *) arena_push ((__arena), sizeof (__type) * (__count)))
+
+/* Carve a child arena out of a parent so it never touches the heap. */
+static void
+arena_init_sub (struct arena *arena, struct arena *parent, size_t size)
+{
+    arena->base = arena_push (parent, size);
+    arena->size = size;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->owned = false;
+
+    ASSERT (arena->base);
+}
+
+static void
+arena_reset (struct arena *arena)
+{
+    arena->used = 0;
+}
+
+static void
+arena_free (struct arena *arena)
+{
+    if (arena->owned)
+    {
+        heap_free (arena->base);
+    }
+
+    *arena = (struct arena) {0};
+}
+
+/*
+ * Fixed-size object pool on top of an arena. Freed slots go on an index
+ * stack and are handed out again before the high-water mark moves.
+ */
+struct pool
+{
+    u8 *items;
+    u8 *live;
+    u32 *free_slots;
+    size_t stride;
+    u32 capacity;
+    u32 count;
+    u32 high_water;
+    u32 n_free;
+};
+
+static void
+pool_init (struct pool *pool, struct arena *arena, size_t stride, u32 capacity)
+{
+    pool->stride = (stride + (ARENA_ALIGN - 1)) & ~(size_t) (ARENA_ALIGN - 1);
+    pool->capacity = capacity;
+    pool->count = 0;
+    pool->high_water = 0;
+    pool->n_free = 0;
+    pool->items = arena_push (arena, pool->stride * capacity);
+    pool->live = ARENA_PUSH_ARRAY (arena, u8, capacity);
+    pool->free_slots = ARENA_PUSH_ARRAY (arena, u32, capacity);
+
+    ASSERT (pool->items && pool->live && pool->free_slots);
+}
+
+static void *
+pool_at (struct pool *pool, u32 index)
+{
+    return pool->items + index * pool->stride;
+}
+
+static bool
+pool_alive (struct pool *pool, u32 index)
+{
+    return pool->live[index];
+}
+
+static void *
+pool_alloc (struct pool *pool)
+{
+    void *item = NULL;
+    u32 index = UINT32_MAX;
+
+    if (pool->n_free > 0)
+    {
+        index = pool->free_slots[--pool->n_free];
+    }
+    else if (pool->high_water < pool->capacity)
+    {
+        index = pool->high_water++;
+    }
+
+    if (index != UINT32_MAX)
+    {
+        item = pool_at (pool, index);
+        memset (item, 0, pool->stride);
+        pool->live[index] = 1;
+        pool->count++;
+    }
+
+    return item;
+}
+
+static void
+pool_free (struct pool *pool, void *item)
+{
+    u32 index = (u32) (((u8 *) item - pool->items) / pool->stride);
+
+    ASSERT (index < pool->high_water && pool->live[index]);
+
+    pool->live[index] = 0;
+    pool->free_slots[pool->n_free++] = index;
+    pool->count--;
+}
+
+static u32
+pool_index (struct pool *pool, void *item)
+{
+    return (u32) (((u8 *) item - pool->items) / pool->stride);
+}
+
+#endif
@@ -11,8 +11,19 @@ set exe=auto-pong.exe
 set libs=Shell32.lib SDL2.lib SDL2main.lib box2d.lib
 set cflags=-Zi -nologo -Fe: %exe% /I include
 set ldflags=/link /subsystem:console /libpath:lib\x64 %libs%
-set source=main.c
+set source=main.c sim.c
+
+rem embedded levels, compiled to tables main.c includes
+cl -O2 -nologo mapc.c -Fe: mapc.exe || exit /b 1
+mapc -name default -o level_default.h || exit /b 1
+mapc -name large -gen 1024x1024 -balls 64 -o level_large.h || exit /b 1
 
 cl %cflags% %source% %ldflags%
 
+rem metrics reader
+cl -Zi -nologo metrics.c -Fe: auto-pong-metrics.exe
+
+rem batched environments as a standalone library
+cl -O2 -nologo /LD /DSIM_DLL sim.c /Fe: auto-pong-sim.dll /I include
+
 ctags -R --langmap=c:.c.h.cpp --languages=c .
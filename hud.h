@@ -0,0 +1,243 @@
+#ifndef _HUD_
+#define _HUD_
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h> // qsort ()
+
+#include <SDL2/SDL.h>
+
+#include "util.h"
+#include "arena.h"
+
+/*
+ * Text overlay. Glyphs are baked once into a small atlas texture, so a line
+ * of text is one SDL_RenderCopy () per character from the same texture,
+ * which SDL batches.
+ *
+ * The font is 3x5, upper case, ASCII 32 to 95. Each glyph is 15 bits, five
+ * rows of three, top row in the high bits.
+ */
+
+#define HUD_GLYPH_W      3
+#define HUD_GLYPH_H      5
+#define HUD_CELL_W       (HUD_GLYPH_W + 1)
+#define HUD_CELL_H       (HUD_GLYPH_H + 1)
+#define HUD_FIRST_CHAR   32
+#define HUD_N_GLYPHS     64
+#define HUD_ATLAS_COLS   16
+#define HUD_SCALE        2
+#define HUD_SAMPLES      256 // frames kept for the percentiles
+#define HUD_REFRESH      30  // frames between percentile updates
+
+static const u16 hud_font[HUD_N_GLYPHS] = {
+    0x0000, 0x2482, 0x5A00, 0x5F7D, 0x3C9E, 0x52A5, 0x2AAB, 0x2400, //  !"#$%&'
+    0x1491, 0x4494, 0x0AA8, 0x05D0, 0x0014, 0x01C0, 0x0002, 0x12A4, // ()*+,-./
+    0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249, // 01234567
+    0x7BEF, 0x7BCF, 0x0410, 0x0414, 0x1511, 0x0E38, 0x4454, 0x72C2, // 89:;<=>?
+    0x7BE3, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B, // @ABCDEFG
+    0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A, // HIJKLMNO
+    0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD, // PQRSTUVW
+    0x5AAD, 0x5A92, 0x72A7, 0x3493, 0x4889, 0x6496, 0x2A00, 0x0007, // XYZ[\]^_
+};
+
+/*
+ * Ring of the last HUD_SAMPLES values with percentiles refreshed every
+ * HUD_REFRESH samples, so the sort doesn't happen every frame.
+ */
+struct hud_samples
+{
+    float values[HUD_SAMPLES];
+    u32 count;
+    u32 next;
+    float p50, p95, p99, max;
+};
+
+struct hud
+{
+    SDL_Texture *atlas;
+    bool visible;
+    int x, y; // next line
+
+    struct hud_samples frame; // present to present, ms
+    struct hud_samples work;  // frame minus the sleep, ms
+    struct hud_samples input; // input event to the present showing it, ms
+    u32 frames;
+
+    u64 second_start;
+    u64 second_ticks;
+    u64 second_flips;
+    float tps;
+    float flips_per_second;
+};
+
+static bool
+hud_init (struct hud *hud, SDL_Renderer *renderer)
+{
+    int w = HUD_ATLAS_COLS * HUD_CELL_W;
+    int h = (HUD_N_GLYPHS / HUD_ATLAS_COLS) * HUD_CELL_H;
+    u32 pixels[HUD_ATLAS_COLS * HUD_CELL_W * (HUD_N_GLYPHS / HUD_ATLAS_COLS) * HUD_CELL_H] = {0};
+
+    for (int g = 0; g < HUD_N_GLYPHS; g++)
+    {
+        int gx = (g % HUD_ATLAS_COLS) * HUD_CELL_W;
+        int gy = (g / HUD_ATLAS_COLS) * HUD_CELL_H;
+
+        for (int row = 0; row < HUD_GLYPH_H; row++)
+        {
+            for (int col = 0; col < HUD_GLYPH_W; col++)
+            {
+                int bit = (HUD_GLYPH_H - 1 - row) * HUD_GLYPH_W + (HUD_GLYPH_W - 1 - col);
+
+                if (hud_font[g] & (1 << bit))
+                {
+                    pixels[(gy + row) * w + gx + col] = 0xFFFFFFFF;
+                }
+            }
+        }
+    }
+
+    hud->atlas = SDL_CreateTexture (renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, w, h);
+
+    if (!hud->atlas)
+    {
+        return false;
+    }
+
+    SDL_UpdateTexture (hud->atlas, NULL, pixels, w * sizeof (u32));
+    SDL_SetTextureBlendMode (hud->atlas, SDL_BLENDMODE_BLEND);
+
+    return true;
+}
+
+static void
+hud_shutdown (struct hud *hud)
+{
+    if (hud->atlas)
+    {
+        SDL_DestroyTexture (hud->atlas);
+        hud->atlas = NULL;
+    }
+}
+
+static int
+hud_compare (const void *a, const void *b)
+{
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+hud_refresh (struct hud_samples *samples, struct arena *scratch)
+{
+    u32 n = samples->count;
+    float *sorted = ARENA_PUSH_ARRAY (scratch, float, n);
+
+    if (sorted && n > 0)
+    {
+        memcpy (sorted, samples->values, sizeof (float) * n);
+        qsort (sorted, n, sizeof (float), hud_compare);
+
+        samples->p50 = sorted[n * 50 / 100];
+        samples->p95 = sorted[n * 95 / 100];
+        samples->p99 = sorted[n * 99 / 100];
+        samples->max = sorted[n - 1];
+    }
+}
+
+static void
+hud_sample (struct hud_samples *samples, float value, struct arena *scratch)
+{
+    samples->values[samples->next] = value;
+    samples->next = (samples->next + 1) % HUD_SAMPLES;
+    samples->count = MIN (samples->count + 1, HUD_SAMPLES);
+
+    if (samples->next % HUD_REFRESH == 0)
+    {
+        hud_refresh (samples, scratch);
+    }
+}
+
+/*
+ * Rates over the last whole second.
+ */
+static void
+hud_rates (struct hud *hud, u64 now, u64 frequency, u64 ticks, u64 flips)
+{
+    if (hud->second_start == 0)
+    {
+        hud->second_start = now;
+        hud->second_ticks = ticks;
+        hud->second_flips = flips;
+    }
+    else if (now - hud->second_start >= frequency)
+    {
+        float seconds = (float) (now - hud->second_start) / frequency;
+
+        hud->tps = (ticks - hud->second_ticks) / seconds;
+        hud->flips_per_second = (flips - hud->second_flips) / seconds;
+        hud->second_start = now;
+        hud->second_ticks = ticks;
+        hud->second_flips = flips;
+    }
+}
+
+static void
+hud_begin (struct hud *hud, SDL_Renderer *renderer, int lines, int columns)
+{
+    SDL_Rect backdrop = {
+        .x = 0,
+        .y = 0,
+        .w = (columns * HUD_CELL_W + 2) * HUD_SCALE,
+        .h = (lines * HUD_CELL_H + 2) * HUD_SCALE,
+    };
+
+    SDL_SetRenderDrawBlendMode (renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor (renderer, 0x00, 0x00, 0x00, 0xB0);
+    SDL_RenderFillRect (renderer, &backdrop);
+    SDL_SetRenderDrawBlendMode (renderer, SDL_BLENDMODE_NONE);
+
+    hud->x = 2 * HUD_SCALE;
+    hud->y = 2 * HUD_SCALE;
+}
+
+static void
+hud_line (struct hud *hud, SDL_Renderer *renderer, const char *fmt, ...)
+{
+    char text[128];
+    va_list args;
+
+    va_start (args, fmt);
+    vsnprintf (text, sizeof (text), fmt, args);
+    va_end (args);
+
+    int x = hud->x;
+    for (const char *c = text; *c; c++)
+    {
+        int g = toupper ((u8) *c) - HUD_FIRST_CHAR;
+
+        if (g > 0 && g < HUD_N_GLYPHS)
+        {
+            SDL_Rect src = {
+                .x = (g % HUD_ATLAS_COLS) * HUD_CELL_W,
+                .y = (g / HUD_ATLAS_COLS) * HUD_CELL_H,
+                .w = HUD_GLYPH_W,
+                .h = HUD_GLYPH_H,
+            };
+            SDL_Rect dst = { x, hud->y, HUD_GLYPH_W * HUD_SCALE, HUD_GLYPH_H * HUD_SCALE };
+
+            SDL_RenderCopy (renderer, hud->atlas, &src, &dst);
+        }
+
+        x += HUD_CELL_W * HUD_SCALE;
+    }
+
+    hud->y += HUD_CELL_H * HUD_SCALE;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef _LEVEL_
+#define _LEVEL_
+
+#include <stdio.h>
+#include <ctype.h>
+
+#include "util.h"
+#include "arena.h"
+
+/*
+ * Tile encoding, one byte per cell (see map.h)
+ *
+ * WALL   0000 0001
+ * BLOCK  0000 0010
+ * PLAYER 0000 0100
+ *
+ * LIGHT  0001 0000
+ * DARK   0010 0000
+ */
+#define TILE_WALL   0x01
+#define TILE_BLOCK  0x02
+#define TILE_PLAYER 0x04
+
+#define TILE_LIGHT  0x10
+#define TILE_DARK   0x20
+
+#define TILE_TYPE(__c) ((__c) & 0x0F)
+#define TILE_TEAM(__c) (((__c) & 0xF0) >> 4)
+
+struct level
+{
+    int w, h;
+    u8 *cells; // w * h, row major
+};
+
+/*
+ * A level preprocessed at build time by mapc (see mapc.c): cells already
+ * decoded into live tiles, the balls listed, and each chunk's walls merged
+ * into as few rectangles as a greedy pass finds.
+ */
+struct level_rect
+{
+    u8 x, y, w, h; // tiles, relative to the chunk
+};
+
+struct level_spawn
+{
+    int x, y;
+    int team;
+};
+
+struct level_table
+{
+    const char *name;
+    int w, h;
+    const u8 *tiles;     // w * h, WALL or BLOCK | team, what's under a ball included
+    u32 territory[3];    // blocks per team
+    u32 n_spawns;
+    const struct level_spawn *spawns;
+    int chunk_shift;     // the rects are only usable if this matches the game's
+    const u32 *chunk_rects;          // per chunk, row major, where its rects start; one more at the end
+    const struct level_rect *rects;
+};
+
+/*
+ * The live tile for a cell: a ball starts on a block of the other team.
+ */
+static u8
+level_tile (u8 cell)
+{
+    switch (TILE_TYPE (cell))
+    {
+        case TILE_WALL:
+            return TILE_WALL;
+        case TILE_BLOCK:
+            return cell;
+        case TILE_PLAYER:
+            return TILE_BLOCK | (TILE_TEAM (cell) == 0x1 ? TILE_DARK : TILE_LIGHT);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Cells index per-team tables by their team bits, so anything outside the
+ * encoding above is rejected rather than trusted.
+ */
+static bool
+level_cell_valid (u32 value)
+{
+    u32 type = TILE_TYPE (value);
+
+    return value <= 0xFF && TILE_TEAM (value) <= 0x2 &&
+           (type == 0 || type == TILE_WALL || type == TILE_BLOCK || type == TILE_PLAYER);
+}
+
+static bool
+level_from_u32 (struct level *level, const u32 *cells, int w, int h, struct arena *arena)
+{
+    level->w = w;
+    level->h = h;
+    level->cells = ARENA_PUSH_ARRAY (arena, u8, w * h);
+
+    if (!level->cells)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < w * h; i++)
+    {
+        if (!level_cell_valid (cells[i]))
+        {
+            return false;
+        }
+        level->cells[i] = (u8) cells[i];
+    }
+
+    return true;
+}
+
+/*
+ * Text maps use the same layout as the initialiser in map.h: one row per
+ * line, cells as decimal numbers, anything else is a separator. Lines
+ * starting with '#' are comments. Every row must have the same width.
+ */
+static bool
+level_parse (struct level *level, const char *text, size_t len, struct arena *arena)
+{
+    int w = 0;
+    int h = 0;
+    int row = 0;
+    const char *end = text + len;
+
+    // first pass: validate the shape
+    for (const char *c = text; c < end; c++)
+    {
+        if (*c == '#')
+        {
+            while (c < end && *c != '\n') c++;
+        }
+        else if (isdigit ((u8) *c))
+        {
+            while (c + 1 < end && isdigit ((u8) c[1])) c++;
+            row++;
+        }
+
+        if (c >= end - 1 || *c == '\n')
+        {
+            if (row > 0)
+            {
+                if (w != 0 && row != w)
+                {
+                    return false;
+                }
+
+                w = row;
+                h++;
+            }
+            row = 0;
+        }
+    }
+
+    if (w == 0 || h == 0)
+    {
+        return false;
+    }
+
+    level->w = w;
+    level->h = h;
+    level->cells = ARENA_PUSH_ARRAY (arena, u8, w * h);
+
+    if (!level->cells)
+    {
+        return false;
+    }
+
+    // second pass: fill
+    u8 *out = level->cells;
+    for (const char *c = text; c < end; c++)
+    {
+        if (*c == '#')
+        {
+            while (c < end && *c != '\n') c++;
+        }
+        else if (isdigit ((u8) *c))
+        {
+            u32 value = 0;
+            while (c < end && isdigit ((u8) *c))
+            {
+                u32 digit = *c++ - '0';
+                value = MIN (value * 10 + digit, 0x100); // saturate, it's invalid either way
+            }
+
+            if (!level_cell_valid (value))
+            {
+                return false;
+            }
+            *out++ = (u8) value;
+            c--;
+        }
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,426 @@
+#ifndef _LOG_
+#define _LOG_
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "util.h"
+
+/*
+ * Leveled asynchronous logger.
+ *
+ * Callers only copy the format pointer and raw argument values into a
+ * per-thread single-producer/single-consumer ring; a background thread does
+ * the formatting and the I/O. Levels below LOG_MIN_LEVEL compile to nothing.
+ *
+ * The format must be a string literal and any %s argument must outlive the
+ * record (string literals, static tables), since only the pointer is copied.
+ */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE   4096 // records per thread, power of two
+#define LOG_MAX_THREADS 16
+#define LOG_MAX_ARGS    8
+
+struct log_record
+{
+    u64 timestamp;
+    const char *fmt;
+    u8 level;
+    u8 n_args;
+    u64 args[LOG_MAX_ARGS];
+};
+
+struct log_ring
+{
+    volatile u32 head; // only written by the producer
+    volatile u32 tail; // only written by the consumer
+    volatile u32 dropped; // only written by the producer
+    u32 reported; // dropped as of the last report, consumer only
+    struct log_record records[LOG_RING_SIZE];
+};
+
+struct log_state
+{
+    struct log_ring rings[LOG_MAX_THREADS];
+    volatile LONG n_rings;
+
+    HANDLE thread;
+    volatile bool running;
+    u64 start;
+    u64 frequency;
+};
+
+static struct log_state log_state;
+static __declspec (thread) struct log_ring *log_thread_ring;
+
+static u64
+log_now (void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter (&now);
+    return now.QuadPart;
+}
+
+static struct log_ring *
+log_ring_get (void)
+{
+    if (!log_thread_ring)
+    {
+        LONG index = InterlockedIncrement (&log_state.n_rings) - 1;
+
+        if (index < LOG_MAX_THREADS)
+        {
+            log_thread_ring = &log_state.rings[index];
+        }
+    }
+
+    return log_thread_ring;
+}
+
+/*
+ * Length modifiers add up to 2 for a 64-bit argument. long is 32 bits on
+ * Win64, so l alone doesn't widen but ll, z, j and t do.
+ */
+static int
+log_length (char c)
+{
+    return c == 'l' ? 1 : c == 'z' || c == 'j' || c == 't' ? 2 : 0;
+}
+
+/*
+ * Walk the conversions in fmt and copy each argument's bits into the record.
+ * No formatting happens here.
+ */
+static void
+log_write (int level, const char *fmt, ...)
+{
+    struct log_ring *ring = log_ring_get ();
+
+    if (!ring)
+    {
+        return;
+    }
+
+    u32 head = ring->head;
+    if (head - ring->tail >= LOG_RING_SIZE)
+    {
+        ring->dropped++;
+        return;
+    }
+
+    struct log_record *r = &ring->records[head & (LOG_RING_SIZE - 1)];
+    va_list args;
+
+    r->timestamp = log_now ();
+    r->fmt = fmt;
+    r->level = level;
+    r->n_args = 0;
+
+    va_start (args, fmt);
+    for (const char *c = fmt; *c && r->n_args < LOG_MAX_ARGS; c++)
+    {
+        if (*c != '%')
+        {
+            continue;
+        }
+
+        c++;
+        if (*c == '%')
+        {
+            continue;
+        }
+
+        int longs = 0;
+        while (*c && strchr ("-+ #0123456789.*hlzjt", *c))
+        {
+            if (*c == '*' && r->n_args < LOG_MAX_ARGS)
+            {
+                r->args[r->n_args++] = va_arg (args, int);
+            }
+            longs += log_length (*c);
+            c++;
+        }
+
+        // a '*' can take the last slot, leave the conversion for the formatter to zero
+        if (r->n_args == LOG_MAX_ARGS)
+        {
+            break;
+        }
+
+        switch (*c)
+        {
+            case 'd': case 'i':
+                r->args[r->n_args++] = longs >= 2 ? va_arg (args, long long) : va_arg (args, int);
+                break;
+            case 'u': case 'x': case 'X': case 'o': case 'c':
+                r->args[r->n_args++] = longs >= 2 ? va_arg (args, unsigned long long) : va_arg (args, unsigned int);
+                break;
+            case 'f': case 'F': case 'g': case 'G': case 'e': case 'E':
+            {
+                double d = va_arg (args, double);
+                memcpy (&r->args[r->n_args++], &d, sizeof (d));
+            } break;
+            case 's': case 'p':
+                r->args[r->n_args++] = (u64) (uintptr_t) va_arg (args, void *);
+                break;
+            default:
+                c--;
+                break;
+        }
+    }
+    va_end (args);
+
+    // x64: stores are not reordered with other stores, stop the compiler doing it
+    _WriteBarrier ();
+    ring->head = head + 1;
+}
+
+static const char *
+log_level_str (int level)
+{
+    switch (level)
+    {
+        case LOG_LEVEL_TRACE: { return "TRACE"; }
+        case LOG_LEVEL_DEBUG: { return "DEBUG"; }
+        case LOG_LEVEL_INFO:  { return "INFO "; }
+        case LOG_LEVEL_WARN:  { return "WARN "; }
+        case LOG_LEVEL_ERROR: { return "ERROR"; }
+        default:              { return "?????"; }
+    }
+}
+
+static int
+log_format (char *out, int size, struct log_record *r)
+{
+    int len = 0;
+    int arg = 0;
+    const char *c = r->fmt;
+
+    len += snprintf (out, size, "[%10.6f] %s ",
+            (double) (long long) (r->timestamp - log_state.start) / log_state.frequency,
+            log_level_str (r->level));
+
+    while (*c && len < size - 1)
+    {
+        if (*c != '%')
+        {
+            out[len++] = *c++;
+            continue;
+        }
+
+        // copy one conversion spec so snprintf can do the actual work
+        char spec[32];
+        int n = 0;
+        int longs = 0;
+        int star = -1;
+
+        spec[n++] = *c++;
+        if (*c == '%')
+        {
+            out[len++] = *c++;
+            continue;
+        }
+
+        while (*c && strchr ("-+ #0123456789.*hlzjt", *c) && n < (int) sizeof (spec) - 2)
+        {
+            if (*c == '*')
+            {
+                star = arg < r->n_args ? (int) r->args[arg++] : 0;
+            }
+            if (log_length (*c))
+            {
+                longs += log_length (*c);
+            }
+            else
+            {
+                spec[n++] = *c;
+            }
+            c++;
+        }
+
+        char conv = *c ? *c++ : 's';
+        u64 value = arg < r->n_args ? r->args[arg++] : 0;
+        int room = size - len;
+        int written = 0;
+
+        if (longs >= 2 && strchr ("diuxXo", conv))
+        {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+        }
+        spec[n++] = conv;
+        spec[n] = '\0';
+
+#define LOG_SNPRINTF(__value) (star >= 0 \
+        ? snprintf (out + len, room, spec, star, (__value)) \
+        : snprintf (out + len, room, spec, (__value)))
+
+        switch (conv)
+        {
+            case 'd': case 'i':
+                written = longs >= 2 ? LOG_SNPRINTF ((long long) value) : LOG_SNPRINTF ((int) value);
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                written = longs >= 2 ? LOG_SNPRINTF ((unsigned long long) value) : LOG_SNPRINTF ((unsigned int) value);
+                break;
+            case 'c':
+                written = LOG_SNPRINTF ((int) value);
+                break;
+            case 'f': case 'F': case 'g': case 'G': case 'e': case 'E':
+            {
+                double d;
+                memcpy (&d, &value, sizeof (d));
+                written = LOG_SNPRINTF (d);
+            } break;
+            case 's':
+                written = LOG_SNPRINTF (value ? (char *) (uintptr_t) value : "(null)");
+                break;
+            case 'p':
+                written = LOG_SNPRINTF ((void *) (uintptr_t) value);
+                break;
+        }
+
+#undef LOG_SNPRINTF
+
+        len += MAX (0, MIN (written, room - 1));
+    }
+
+    out[MIN (len, size - 1)] = '\0';
+
+    return MIN (len, size - 1);
+}
+
+static bool
+log_drain (void)
+{
+    bool any = false;
+    char line[1024];
+
+    for (LONG i = 0; i < MIN (log_state.n_rings, LOG_MAX_THREADS); i++)
+    {
+        struct log_ring *ring = &log_state.rings[i];
+        u32 head = ring->head;
+
+        _ReadBarrier ();
+
+        while (ring->tail != head)
+        {
+            struct log_record *r = &ring->records[ring->tail & (LOG_RING_SIZE - 1)];
+            FILE *stream = r->level >= LOG_LEVEL_WARN ? stderr : stdout;
+            int len = log_format (line, sizeof (line), r);
+
+            fwrite (line, 1, len, stream);
+            if (len == 0 || line[len - 1] != '\n')
+            {
+                fputc ('\n', stream);
+            }
+
+            _ReadWriteBarrier ();
+            ring->tail = ring->tail + 1;
+            any = true;
+        }
+
+        u32 dropped = ring->dropped;
+        if (dropped != ring->reported)
+        {
+            fprintf (stderr, "log: dropped %u records\n", dropped - ring->reported);
+            ring->reported = dropped;
+        }
+    }
+
+    if (any)
+    {
+        fflush (stdout);
+    }
+
+    return any;
+}
+
+static DWORD WINAPI
+log_thread (void *param)
+{
+    while (log_state.running)
+    {
+        if (!log_drain ())
+        {
+            Sleep (1);
+        }
+    }
+
+    log_drain ();
+
+    return 0;
+}
+
+static void
+log_init (void)
+{
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceFrequency (&frequency);
+    log_state.frequency = frequency.QuadPart;
+    log_state.start = log_now ();
+    log_state.running = true;
+    log_state.thread = CreateThread (NULL, 0, log_thread, NULL, 0, NULL);
+
+    ASSERT (log_state.thread);
+}
+
+static void
+log_shutdown (void)
+{
+    if (log_state.thread)
+    {
+        log_state.running = false;
+        WaitForSingleObject (log_state.thread, INFINITE);
+        CloseHandle (log_state.thread);
+        log_state.thread = NULL;
+    }
+}
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) log_write (LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void) 0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_write (LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void) 0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_write (LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void) 0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) log_write (LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void) 0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) log_write (LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void) 0)
+#endif
+
+#endif
@@ -1,13 +1,25 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h> // rand ()
+#include <string.h>
+#include <math.h>
 
 #include <SDL2/SDL.h>
 #include <box2d/box2d.h>
 
 #include "util.h"
 #include "trace.h"
+#include "arena.h"
+#include "log.h"
+#include "level.h"
+#include "sim.h"
+#include "replay.h"
+#include "mapgen.h"
+#include "hud.h"
+#include "metrics.h"
 #include "map.h"
+#include "level_default.h" // generated by mapc, see build.bat
+#include "level_large.h"
 #include "vector2.h"
 
 
@@ -18,6 +30,24 @@
 #define BUFFER_HEIGHT   32
 #define BLOCK_SIZE_PX   30
 
+#define ARENA_SIZE          MEGABYTES (16)
+#define SCRATCH_ARENA_SIZE  MEGABYTES (1)
+#define ALLOC_WARMUP_TICKS  120
+#define GAME_SEED           117
+
+#define REPLAY_SEEK_TICKS   300
+
+#define BENCH_TICKS         600
+#define BENCH_ENV_STEPS     (1 << 21) // total env-steps per row of bench_env
+#define BENCH_MAP_SIZE      1024
+#define BENCH_LOAD_RUNS     8
+#define BENCH_OWN_BLOCKS    20 // one block in this many is the balls' own team
+
+#define CHUNK_SHIFT         4
+#define CHUNK_SIZE          (1 << CHUNK_SHIFT) // tiles per side
+#define CHUNK_LINGER_TICKS  30                 // idle ticks before a chunk is dematerialised
+#define BALL_POOL_SLACK     256                // room for balls spawned by map reloads
+
 
 struct entity
 {
@@ -34,7 +64,7 @@ struct entity
         E_TYPE_BALL
     } type;
 
-    enum team
+    enum team // same values as the team bits in the map
     {
         E_TEAM_NONE = 0,
         E_TEAM_LIGHT,
@@ -46,6 +76,53 @@ struct entity
     b2BodyId body_id;
 };
 
+/*
+ * The map is split into CHUNK_SIZE squares. Tiles always stay in the compact
+ * game->tiles grid; a chunk is only materialised into physics bodies while a
+ * ball is in it or next to it.
+ */
+struct chunk
+{
+    b2BodyId body_id; // every wall in the chunk, Box2D only
+    u64 last_active;  // last tick a ball was in or next to it
+    bool materialised;
+    bool dirty;       // walls changed by a reload while materialised
+};
+
+struct game;
+
+/* Last step, in ms where it's a time. */
+struct physics_profile
+{
+    float step;
+    float collide;
+    float solve;
+    float broadphase;
+    int bodies;
+    int contacts;
+    int tasks;
+};
+
+/*
+ * Physics backends move the balls, bounce them off walls and own-team
+ * blocks, and keep e->pos and e->velocity up to date for everything else.
+ * Tiles are read from the grid; chunk_load/chunk_unload is where a backend
+ * builds and drops whatever it needs for the tiles around the balls.
+ */
+struct physics_backend
+{
+    const char *name;
+    void (*init) (struct game *game);
+    void (*shutdown) (struct game *game);
+    void (*add) (struct game *game, struct entity *ball);
+    void (*remove) (struct game *game, struct entity *ball);
+    void (*chunk_load) (struct game *game, int cx, int cy);
+    void (*chunk_unload) (struct game *game, int cx, int cy);
+    void (*step) (struct game *game, float dt);
+    void (*draw) (struct game *game); // optional
+    void (*profile) (struct game *game, struct physics_profile *profile); // optional
+};
+
 struct game
 {
     u32 *buffer;
@@ -54,39 +131,64 @@ struct game
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
-
-    u32 n_entities;
-    struct entity entities[512];
-
-    u32 n_players;
-    struct entity *players[2];
+    SDL_Texture *tile_layer; // tiles as of layer_tick, NULL if targets are unsupported
+    u64 layer_tick;
+    bool layer_stale;        // redraw all of it
+
+    struct arena arena;   // lives as long as the game
+    struct arena level;   // per-world data, sized by and reset with the map
+    struct arena scratch; // per-frame, reset every tick
+
+    struct pool balls;
+
+    int map_w, map_h;
+    u8 *map;   // cells as last loaded, see level.h
+    u8 *tiles; // live tiles, WALL or BLOCK | team, flips included
+    u64 *occupancy; // per-team bitmaps of tiles, see sim_grid
+
+    int chunks_w, chunks_h;
+    struct chunk *chunks;
+    u32 *loaded; // materialised chunks
+    u32 n_loaded;
+    const u32 *chunk_rects;          // merged walls from a level table, NULL to use the tiles
+    const struct level_rect *wall_rects;
+
+    const char *map_path;  // NULL when playing an embedded map
+    const struct level_table *embedded;
+    struct mapgen_params gen; // generated map instead, when gen.w > 0
+    HANDLE map_watch;
+
+    const struct physics_backend *physics;
+    u64 flips;
+    u32 territory[3];  // blocks per team
+    u32 team_balls[3];
+    u32 *flipped; // cells flipped this tick, see sim_grid
+    u32 n_flipped;
+    u32 max_flipped;
+
+    struct replay_recorder replay;
 
     float dt;
+    u64 tick;
+    float step_ms;
+    u64 input_time; // oldest input not yet presented, 0 if none
+    u64 loop_allocs;   // heap allocations made during the last pass of the main loop
+    u64 steady_allocs; // heap allocations made after ALLOC_WARMUP_TICKS
 
     b2WorldId world_id;
     int sub_step_count;
     b2DebugDraw debug_draw;
-};
-
-enum direction
-{
-    UP = 0,
-    RIGHT,
-    DOWN,
-    LEFT
-};
+    bool debug_visible; // F2, walks every shape in the world
 
-struct collision
-{
-    bool hit;
-    enum direction direction;
-    v2 vector;
+    struct hud hud;
+    struct metrics metrics;
 };
 
 /*
  * Globals
  */
 static volatile bool running;
+static const struct level_table *levels[] = { &level_default, &level_large };
 
 
 static char *
@@ -100,19 +202,6 @@ colour_str (struct entity *e)
     }
 }
 
-static char *
-direction_str (enum direction dir)
-{
-    switch (dir)
-    {
-        case UP:    { return "Up"; }
-        case LEFT:  { return "Left"; }
-        case RIGHT: { return "Right"; }
-        case DOWN:  { return "Down"; }
-        default:    { return "N/A"; }
-    }
-}
-
 static u32
 team_colour (struct entity *e)
 {
@@ -152,13 +241,13 @@ randf (float min, float max)
     return (r / RAND_MAX) * (max - min) + min;
 }
 
-static void
+static struct entity *
 add_entity (struct game *game, enum entity_type type, int x, int y, enum team team)
 {
-    if (game->n_entities < LEN (game->entities))
-    {
-        struct entity *e = &game->entities[game->n_entities++];
+    struct entity *e = pool_alloc (&game->balls);
 
+    if (e)
+    {
         e->pos.x = x;
         e->pos.y = y;
         e->size.w = 1.0f;
@@ -166,559 +255,2115 @@ add_entity (struct game *game, enum entity_type type, int x, int y, enum team te
         e->type = type;
         e->team = team;
         e->colour = team_colour (e);
+        e->velocity.x = randf (-10.0f, 10.0f);
+        e->velocity.y = randf (-10.0f, 10.0f);
+        e->radius = 0.5f;
 
-        if (e->type == E_TYPE_BALL)
-        {
-            v2 velocity;
-
-            velocity.x = randf (-10.0f, 10.0f);
-            velocity.y = randf (-10.0f, 10.0f);
-
-            game->players[game->n_players++] = e;
-            e->velocity.x = velocity.x;
-            e->velocity.y = velocity.y;
-            e->radius = 0.5f;
-
-            b2BodyDef body_def = b2DefaultBodyDef ();
-            body_def.position = (b2Vec2) { x, y };
-            body_def.type = b2_dynamicBody;
-            body_def.gravityScale = 0.0f;
-            body_def.linearVelocity.x = velocity.x;
-            body_def.linearVelocity.y = velocity.y;
-            e->body_id = b2CreateBody (game->world_id, &body_def);
-
-            b2Circle circle;
-//            circle.center = (b2Vec2) { x, y };
-            circle.radius = 0.5f;
-            b2ShapeDef shape_def = b2DefaultShapeDef ();
-            shape_def.density = 1.0f;
-            shape_def.friction = 0.0f;
-            shape_def.restitution = 1.0f;
-            b2CreateCircleShape (e->body_id, &shape_def, &circle);
-        }
-        else if (e->type == E_TYPE_WALL)
-        {
-            b2BodyDef body_def = b2DefaultBodyDef ();
-            body_def.position = (b2Vec2) { x, y };
-            e->body_id = b2CreateBody (game->world_id, &body_def);
-
-            b2Polygon box = b2MakeBox(0.5f, 0.5f);
-            b2ShapeDef shape_def = b2DefaultShapeDef ();
-            b2CreatePolygonShape (e->body_id, &shape_def, &box);
-        }
+        game->physics->add (game, e);
+        game->team_balls[e->team]++;
 
-        printf ("Add %s [team:%s x:%.02f y:%.02f]\n",
+        LOG_DEBUG ("Add %s [team:%s x:%.02f y:%.02f]",
                 type_str (e), colour_str (e), e->pos.x, e->pos.y);
     }
     else
     {
-        fprintf (stderr, "Failed to add entity\n");
+        LOG_ERROR ("Failed to add entity");
     }
-}
 
+    return e;
+}
 
 static void
-handle_input (void)
+remove_entity (struct game *game, struct entity *e)
 {
-    SDL_Event e;
-
-    while (SDL_PollEvent (&e) != 0)
-    {
-        switch (e.type)
-        {
-            case SDL_QUIT:
-                printf ("quit\n");
-                running = false;
-                break;
-            case SDL_KEYDOWN:
-                if (e.key.keysym.sym == SDLK_ESCAPE)
-                {
-                    printf("esc\n");
-                    running = false;
-                }
-                break;
-        }
-    }
+    game->physics->remove (game, e);
+    game->team_balls[e->team]--;
+    pool_free (&game->balls, e);
 }
 
-#if 0
-static void
-draw_rect (struct game *game, int x, int y, u32 colour)
+static struct chunk *
+chunk_at (struct game *game, int x, int y)
 {
+    return &game->chunks[(y >> CHUNK_SHIFT) * game->chunks_w + (x >> CHUNK_SHIFT)];
+}
 
-    // map = 18x18 blocks
-    // window is 800x600 pixels
-    //
-    // block = 30 pixels
-    // 18 * 30 = 540
-    int window_half_w = WINDOW_WIDTH / 2;
-    int map_size = 18 * 30;
-    int map_half_w = map_size / 2;
-    int offset = window_half_w - map_half_w;
-
-    u32 *ptr = &game->buffer[offset + y * WINDOW_WIDTH + x];
-    *ptr = colour;
+/*
+ * The grid for one physics step; flips are logged after the ones already in
+ * game->flipped. Hand it back to game_grid_done () when the step is over.
+ */
+static struct sim_grid
+game_grid (struct game *game)
+{
+    return (struct sim_grid) {
+        .w = game->map_w,
+        .h = game->map_h,
+        .tiles = game->tiles,
+        .occupancy = game->occupancy,
+        .flipped = game->flipped + MIN (game->n_flipped, game->max_flipped),
+        .max_flipped = game->max_flipped - MIN (game->n_flipped, game->max_flipped),
+    };
 }
-#endif
 
 static void
-draw_circle (SDL_Renderer *renderer, float centreX, float centreY, float radius)
+game_grid_done (struct game *game, struct sim_grid *grid)
 {
-    const float diameter = (radius * 2);
+    game->n_flipped += grid->n_flipped;
+}
 
-    float x = (radius - 1);
-    float y = 0;
-    float tx = 1;
-    float ty = 1;
-    float error = (tx - diameter);
+static void
+cell_create (struct game *game, int x, int y, u8 block, bool spawn_balls)
+{
+    u8 tile = level_tile (block);
 
-    while (x >= y)
+    if (TILE_TYPE (block) == TILE_PLAYER && spawn_balls)
     {
-        //  Each of the following renders an octant of the circle
-        SDL_RenderDrawPoint (renderer, centreX + x, centreY - y);
-        SDL_RenderDrawPoint (renderer, centreX + x, centreY + y);
-        SDL_RenderDrawPoint (renderer, centreX - x, centreY - y);
-        SDL_RenderDrawPoint (renderer, centreX - x, centreY + y);
-        SDL_RenderDrawPoint (renderer, centreX + y, centreY - x);
-        SDL_RenderDrawPoint (renderer, centreX + y, centreY + x);
-        SDL_RenderDrawPoint (renderer, centreX - y, centreY - x);
-        SDL_RenderDrawPoint (renderer, centreX - y, centreY + x);
+        add_entity (game, E_TYPE_BALL, x, y, TILE_TEAM (block));
+    }
 
-        if (error <= 0)
-        {
-            ++y;
-            error += ty;
-            ty += 2;
-        }
+    u8 *live = &game->tiles[y * game->map_w + x];
 
-        if (error > 0)
-        {
-            --x;
-            tx += 2;
-            error += (tx - diameter);
-        }
+    if (TILE_TYPE (*live) == TILE_BLOCK)
+    {
+        game->territory[TILE_TEAM (*live)]--;
+    }
+    if (TILE_TYPE (tile) == TILE_BLOCK)
+    {
+        game->territory[TILE_TEAM (tile)]++;
     }
+
+    game->map[y * game->map_w + x] = block;
+    *live = tile;
 }
 
+/*
+ * n blocks of team were flipped to the other team.
+ */
 static void
-draw_circle_filled (SDL_Renderer *renderer, float centreX, float centreY, float radius)
+blocks_flipped (struct game *game, enum team team, u32 n)
 {
-    int r2 = radius * radius;
-    int area = r2 << 2;
-    int rr = radius * 2;
-
-    // Brute force fill
-    for (int i = 0; i < area; i++)
-    {
-        int tx = (i % rr) - radius;
-        int ty = (i / rr) - radius;
+    enum team other = team == E_TEAM_LIGHT ? E_TEAM_DARK : E_TEAM_LIGHT;
 
-        if (tx * tx + ty * ty <= r2)
-        {
-            SDL_RenderDrawPoint (renderer, centreX + tx, centreY + ty);
-        }
-    }
+    game->flips += n;
+    game->territory[team] -= n;
+    game->territory[other] += n;
 }
 
 static void
-debug_draw_circle (b2Transform xfrm, float radius, b2HexColor color, void *context)
+chunk_load (struct game *game, u32 index)
 {
-    struct game *game = context;
-    b2Vec2 p = xfrm.p;
+    struct chunk *chunk = &game->chunks[index];
 
-    // printf ("%s> p=%.02f,%.02f radius=%.02f\n", __func__, p.x, p.y, radius);
-    draw_circle_filled (game->renderer, (p.x + radius) * BLOCK_SIZE_PX, (p.y + radius) * BLOCK_SIZE_PX, radius * BLOCK_SIZE_PX);
+    game->physics->chunk_load (game, index % game->chunks_w, index / game->chunks_w);
+    chunk->materialised = true;
+    chunk->dirty = false;
+    game->loaded[game->n_loaded++] = index;
 }
 
 static void
-draw_rect (SDL_Renderer *r, v2 topleft, v2 extent, int color)
+chunk_unload (struct game *game, u32 slot)
 {
-    SDL_Rect rect = {
-        .x = topleft.x * BLOCK_SIZE_PX,
-        .y = topleft.y * BLOCK_SIZE_PX,
-        .w = extent.w * BLOCK_SIZE_PX,
-        .h = extent.h * BLOCK_SIZE_PX
-    };
-    int red   = (color & 0x00FF0000) >> 16;
-    int green = (color & 0x0000FF00) >> 8;
-    int blue  = (color & 0x000000FF) >> 0;
-    int alpha = 0xFF;
+    u32 index = game->loaded[slot];
+    struct chunk *chunk = &game->chunks[index];
 
-    SDL_SetRenderDrawColor (r, red, green, blue, alpha);
-    SDL_RenderFillRect (r, &rect);
+    game->physics->chunk_unload (game, index % game->chunks_w, index / game->chunks_w);
+    chunk->materialised = false;
+    game->loaded[slot] = game->loaded[--game->n_loaded];
 }
 
+/*
+ * Materialise the chunks around every ball and drop the ones no ball has
+ * been near for CHUNK_LINGER_TICKS, so the cost follows the balls rather
+ * than the size of the map.
+ */
 static void
-debug_draw_poly (b2Transform xfrm, const b2Vec2* vertices, int vertexCount, float radius, b2HexColor color, void* context)
+chunks_update (struct game *game)
 {
-    struct game *game = context;
-    b2Vec2 p = xfrm.p;
+    for (u32 i = 0; i < game->balls.high_water; i++)
+    {
+        if (!pool_alive (&game->balls, i))
+        {
+            continue;
+        }
 
-    ASSERT (vertexCount == 4);
+        struct entity *e = pool_at (&game->balls, i);
+        int cx = CLAMP ((int) (e->pos.x + e->radius), 0, game->map_w - 1) >> CHUNK_SHIFT;
+        int cy = CLAMP ((int) (e->pos.y + e->radius), 0, game->map_h - 1) >> CHUNK_SHIFT;
 
-    v2 topleft = {
-        .x = p.x, // + vertices[0].x,
-        .y = p.y, // + vertices[0].y,
-    };
-    v2 extent = {
-        .w = fabs (vertices[0].x) + fabs (vertices[2].x),
-        .h = fabs (vertices[0].y) + fabs (vertices[2].y),
-    };
+        for (int y = MAX (0, cy - 1); y <= MIN (game->chunks_h - 1, cy + 1); y++)
+        {
+            for (int x = MAX (0, cx - 1); x <= MIN (game->chunks_w - 1, cx + 1); x++)
+            {
+                u32 index = y * game->chunks_w + x;
+                struct chunk *chunk = &game->chunks[index];
 
-    draw_rect (game->renderer, topleft, extent, color);
+                chunk->last_active = game->tick;
+                if (!chunk->materialised)
+                {
+                    chunk_load (game, index);
+                }
+            }
+        }
+    }
+
+    for (u32 i = 0; i < game->n_loaded;)
+    {
+        struct chunk *chunk = &game->chunks[game->loaded[i]];
+
+        if (game->tick - chunk->last_active > CHUNK_LINGER_TICKS)
+        {
+            chunk_unload (game, i);
+        }
+        else
+        {
+            i++;
+        }
+    }
 }
 
-static bool
-detect_hit_aabb (struct entity *a, v2 new_p, struct entity *b)
+static void
+replay_record (struct game *game)
 {
-    bool hit = false;
+    u32 n_balls = game->balls.high_water;
+    struct replay_ball *balls = game->replay.balls;
 
-    // Simple AABB collision detection
-    if (new_p.x + 1 >= b->pos.x     &&
-        new_p.x     <  b->pos.x + 1 &&
-        new_p.y + 1 >= b->pos.y     &&
-        new_p.y     <  b->pos.y + 1)
+    ASSERT (n_balls <= game->replay.header.max_balls);
+
+    for (u32 i = 0; i < n_balls; i++)
     {
-        hit = true;
+        if (pool_alive (&game->balls, i))
+        {
+            struct entity *e = pool_at (&game->balls, i);
+
+            balls[i].team = e->team;
+            balls[i].q[0] = replay_quantise (e->pos.x + e->radius);
+            balls[i].q[1] = replay_quantise (e->pos.y + e->radius);
+            balls[i].q[2] = replay_quantise (e->velocity.x);
+            balls[i].q[3] = replay_quantise (e->velocity.y);
+        }
+        else
+        {
+            balls[i] = (struct replay_ball) {0};
+        }
     }
 
-    return hit;
+    replay_record_frame (&game->replay, game->tiles, balls, n_balls,
+                         game->flipped, game->n_flipped, game->max_flipped);
 }
 
-static bool
-collision_detect (struct entity *a, struct entity *b, struct collision *collision)
+static void
+metrics_publish (struct game *game)
 {
-    bool hit = false;
-
-    // get center of circle (assumes .pos is the top-left point)
-    v2 a_centre = v2_addf (a->pos, a->radius);
+    struct metrics *metrics = &game->metrics;
+    struct metrics_block *block = metrics->block;
+    u64 now = SDL_GetPerformanceCounter ();
+    u64 frequency = SDL_GetPerformanceFrequency ();
+    float tps = block->tps;
 
-    // calculate target AABB info (centre, half-extents)
-    v2 b_half_extents = v2_divf (b->size, 2.0f);
-    v2 b_centre = v2_add (b->pos, b_half_extents);
+    if (metrics->second_start == 0)
+    {
+        metrics->second_start = now;
+        metrics->second_tick = game->tick;
+    }
+    else if (now - metrics->second_start >= frequency)
+    {
+        tps = (float) (game->tick - metrics->second_tick) * frequency / (now - metrics->second_start);
+        metrics->second_start = now;
+        metrics->second_tick = game->tick;
+    }
 
-    // get difference vector between both centres
-    v2 diff = v2_sub (a_centre, b_centre);
+    metrics_begin (block);
 
-    v2 clamped = v2_clamp (diff, v2_neg (b_half_extents), b_half_extents);
+    block->tick = game->tick;
+    block->flips = game->flips;
+    block->tps = tps;
+    block->step_ms = game->step_ms;
+    block->step_hist[metrics_bucket (game->step_ms)]++;
+    memcpy (block->territory, game->territory, sizeof (block->territory));
+    memcpy (block->balls, game->team_balls, sizeof (block->balls));
 
-    // add clamped value to b_centre and we get the value of box closest to circle
-    v2 closest = v2_add (b_centre, clamped);
+    metrics_end (block);
+}
 
-    // retrieve vector between centre circle and closest point on B and check if
-    // length <= radius
-    diff = v2_sub (closest, a_centre);
+static void
+world_step (struct game *game, float dt)
+{
+    chunks_update (game);
+    game->n_flipped = 0;
 
-    hit = v2_len (diff) < a->radius;
+    u64 start = SDL_GetPerformanceCounter ();
+    game->physics->step (game, dt);
+    game->step_ms = (SDL_GetPerformanceCounter () - start) * 1e3f / SDL_GetPerformanceFrequency ();
+    game->tick++;
 
-    if (hit)
+    if (game->replay.file)
     {
-        collision->hit = true;
-        collision->direction = vector2_direction (diff);
-        collision->vector = diff;
+        replay_record (game);
     }
 
-    return hit;
+    if (game->metrics.block)
+    {
+        metrics_publish (game);
+    }
 }
 
+static size_t
+level_arena_size (int w, int h, u32 n_balls)
+{
+    size_t n = (size_t) w * h;
+    size_t n_chunks = (size_t) ((w + CHUNK_SIZE - 1) >> CHUNK_SHIFT) * ((h + CHUNK_SIZE - 1) >> CHUNK_SHIFT);
+    size_t ball = ((sizeof (struct entity) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1)) + sizeof (u8) + sizeof (u32) +
+                  (SIM_MAX_BOUNCES + 1) * sizeof (u32);
+
+    return 2 * n + sim_occupancy_size (w, h) + n_chunks * (sizeof (struct chunk) + sizeof (u32)) +
+           n_balls * ball + KILOBYTES (4);
+}
 
 static void
-draw_entity (struct game *game, struct entity *e)
+world_clear (struct game *game)
 {
-    SDL_Rect r = {0};
-    v2 pos = e->pos;
-
-    if (e->type == E_TYPE_WALL)
+    while (game->n_loaded > 0)
     {
-        b2Vec2 b2_pos = b2Body_GetPosition (e->body_id);
-        pos.x = b2_pos.x;
-        pos.y = b2_pos.y;
+        chunk_unload (game, game->n_loaded - 1);
     }
 
-    r.x = pos.x * BLOCK_SIZE_PX;
-    r.y = pos.y * BLOCK_SIZE_PX;
-    r.w = BLOCK_SIZE_PX;
-    r.h = BLOCK_SIZE_PX;
-
-    if (e->team == E_TEAM_LIGHT)
-    {
-        SDL_SetRenderDrawColor (game->renderer, 0xEE, 0xEE, 0xEE, 0xFF);
-    }
-    else if (e->team == E_TEAM_DARK)
+    for (u32 i = 0; i < game->balls.high_water; i++)
     {
-        SDL_SetRenderDrawColor (game->renderer, 0x33, 0x33, 0x33, 0xFF);
+        if (pool_alive (&game->balls, i))
+        {
+            remove_entity (game, pool_at (&game->balls, i));
+        }
     }
-    else
+
+    game->tiles = NULL;
+    game->occupancy = NULL;
+}
+
+/*
+ * Throw away the current world and make room for a w x h one with up to
+ * n_balls balls. Tiles start empty.
+ */
+static void
+world_alloc (struct game *game, int w, int h, u32 n_balls)
+{
+    size_t size = level_arena_size (w, h, n_balls);
+
+    world_clear (game);
+
+    if (game->level.size < size)
     {
-        SDL_SetRenderDrawColor (game->renderer, 0xFF, 0x11, 0x11, 0xFF);
+        arena_free (&game->level);
+        arena_init (&game->level, size);
     }
-
-    SDL_RenderFillRect (game->renderer, &r);
+    arena_reset (&game->level);
+
+    game->map_w = w;
+    game->map_h = h;
+    game->map = ARENA_PUSH_ARRAY (&game->level, u8, w * h);
+    game->tiles = ARENA_PUSH_ARRAY (&game->level, u8, w * h);
+    game->occupancy = ARENA_PUSH_ARRAY (&game->level, u64, sim_occupancy_size (w, h) / sizeof (u64));
+    memset (game->territory, 0, sizeof (game->territory));
+
+    game->chunks_w = (w + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    game->chunks_h = (h + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    game->chunks = ARENA_PUSH_ARRAY (&game->level, struct chunk, game->chunks_w * game->chunks_h);
+    game->loaded = ARENA_PUSH_ARRAY (&game->level, u32, game->chunks_w * game->chunks_h);
+    game->n_loaded = 0;
+    game->chunk_rects = NULL;
+    game->wall_rects = NULL;
+
+    pool_init (&game->balls, &game->level, sizeof (struct entity), n_balls);
+
+    // a ball flips at most one block per bounce, Box2D's post-step sweep adds one more
+    game->max_flipped = n_balls * (SIM_MAX_BOUNCES + 1);
+    game->flipped = ARENA_PUSH_ARRAY (&game->level, u32, game->max_flipped);
+    game->n_flipped = 0;
 }
 
-static enum direction
-vector2_direction (v2 target)
+/*
+ * Throw away the current world and build it again from the level.
+ */
+static void
+world_build (struct game *game, struct level *level)
 {
-    v2 compass[] = {
-        [UP]    = {  0.0f, -1.0f },
-        [RIGHT] = {  1.0f,  0.0f },
-        [DOWN]  = {  0.0f,  1.0f },
-        [LEFT]  = { -1.0f,  0.0f }
-    };
-    float max = 0.0f;
-    u32 best_match = UINT32_MAX;
+    u32 n_balls = BALL_POOL_SLACK;
+
+    for (int i = 0; i < level->w * level->h; i++)
+    {
+        n_balls += TILE_TYPE (level->cells[i]) == TILE_PLAYER;
+    }
+
+    world_alloc (game, level->w, level->h, n_balls);
 
-    for (int i = 0; i < LEN (compass); i++)
+    for (int y = 0; y < level->h; y++)
     {
-        float dot_product = v2_inner (v2_norm (target), compass[i]);
-        if (dot_product > max)
+        for (int x = 0; x < level->w; x++)
         {
-            max = dot_product;
-            best_match = i;
+            cell_create (game, x, y, level->cells[y * level->w + x], true);
         }
     }
 
-    return best_match;
+    struct sim_grid grid = game_grid (game);
+    sim_occupancy_build (&grid);
+
+    LOG_INFO ("Added %dx%d tiles in %d chunks, %u balls",
+            level->w, level->h, game->chunks_w * game->chunks_h, game->balls.count);
 }
 
+/*
+ * The same from a level compiled by mapc: tiles and territory are copied
+ * as they are, only the balls are created one by one.
+ */
 static void
-collision_resolve (struct entity *a, struct entity *b, struct collision *collision)
+world_build_table (struct game *game, const struct level_table *table)
 {
-    enum direction dir = collision->direction;
-    v2 diff = collision->vector;
+    size_t n = (size_t) table->w * table->h;
+
+    world_alloc (game, table->w, table->h, table->n_spawns + BALL_POOL_SLACK);
+
+    memcpy (game->tiles, table->tiles, n);
+    memcpy (game->map, table->tiles, n);
+    memcpy (game->territory, table->territory, sizeof (game->territory));
+
+    struct sim_grid grid = game_grid (game);
+    sim_occupancy_build (&grid);
+
+    for (u32 i = 0; i < table->n_spawns; i++)
+    {
+        const struct level_spawn *spawn = &table->spawns[i];
 
-    if (dir == LEFT || dir == RIGHT)
+        game->map[spawn->y * table->w + spawn->x] = TILE_PLAYER | spawn->team << 4;
+        add_entity (game, E_TYPE_BALL, spawn->x, spawn->y, spawn->team);
+    }
+
+    if (table->chunk_shift == CHUNK_SHIFT)
     {
-        a->velocity.x = -a->velocity.x;
+        game->chunk_rects = table->chunk_rects;
+        game->wall_rects = table->rects;
     }
     else
     {
-        a->velocity.y = -a->velocity.y;
+        LOG_WARN ("Level %s was compiled for %d tile chunks, building walls tile by tile",
+                table->name, 1 << table->chunk_shift);
     }
+
+    LOG_INFO ("Added %dx%d tiles in %d chunks, %u balls from the %s table",
+            table->w, table->h, game->chunks_w * game->chunks_h, game->balls.count, table->name);
 }
 
-static void
-update (struct game *game)
+/*
+ * Rebuild only the cells that differ from the current world. Balls in flight
+ * are left alone; a new PLAYER cell spawns a new ball. Materialised chunks
+ * whose walls changed are rebuilt.
+ */
+static u32
+world_diff (struct game *game, struct level *level)
 {
-    for (int i = 0; i < game->n_players; i++)
+    struct sim_grid grid = game_grid (game);
+    u32 changed = 0;
+    int w = level->w;
+
+    for (int y = 0; y < level->h; y++)
     {
-        struct entity *p = game->players[i];
-        struct entity *hit = NULL;
+        u8 *old_row = &game->map[y * w];
+        u8 *new_row = &level->cells[y * w];
 
-        for (int j = 0; j < game->n_entities; j++)
+        if (memcmp (old_row, new_row, w) == 0)
         {
-            struct entity *test = &game->entities[j];
-            struct collision collision = {0};
+            continue;
+        }
 
-            if (collision_detect (p, test, &collision))
+        for (int x = 0; x < w; x++)
+        {
+            if (old_row[x] != new_row[x])
             {
-                if (test->type == E_TYPE_WALL)
-                {
-                    hit = test;
-                }
-                else if (test->type == E_TYPE_BLOCK)
+                bool spawn = TILE_TYPE (new_row[x]) == TILE_PLAYER &&
+                             TILE_TYPE (old_row[x]) != TILE_PLAYER;
+                u8 old_tile = game->tiles[y * w + x];
+
+                cell_create (game, x, y, new_row[x], spawn);
+                sim_occupancy_update (&grid, y * w + x);
+
+                if (old_tile == TILE_WALL || game->tiles[y * w + x] == TILE_WALL)
                 {
-                    if (test->team == p->team)
-                    {
-                        // continue on
-                        if (p->team == E_TEAM_LIGHT)
-                        {
-                            test->team = E_TEAM_DARK;
-                        }
-                        else if (p->team == E_TEAM_DARK)
-                        {
-                            test->team = E_TEAM_LIGHT;
-                        }
-
-                        hit = test;
-                    }
+                    chunk_at (game, x, y)->dirty = true;
+                    game->chunk_rects = NULL;
+                    game->wall_rects = NULL;
                 }
+                changed++;
             }
+        }
+    }
+
+    for (u32 i = 0; i < game->n_loaded;)
+    {
+        u32 index = game->loaded[i];
+
+        if (game->chunks[index].dirty)
+        {
+            chunk_unload (game, i);
+            chunk_load (game, index);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return changed;
+}
+
+static void
+world_load (struct game *game, struct level *level)
+{
+    u64 start = SDL_GetPerformanceCounter ();
+
+    if (game->replay.file)
+    {
+        if (level->w != (int) game->replay.header.w || level->h != (int) game->replay.header.h)
+        {
+            LOG_WARN ("Map size changed, stopping the replay");
+            replay_record_end (&game->replay);
+        }
+        game->replay.force_key = true;
+    }
+
+    game->layer_stale = true;
+
+    if (game->tiles && level->w == game->map_w && level->h == game->map_h)
+    {
+        u32 changed = world_diff (game, level);
+        double us = (SDL_GetPerformanceCounter () - start) * 1e6 / SDL_GetPerformanceFrequency ();
+
+        LOG_INFO ("Map diff: %u cells changed in %.1f us", changed, us);
+    }
+    else
+    {
+        world_build (game, level);
+        double us = (SDL_GetPerformanceCounter () - start) * 1e6 / SDL_GetPerformanceFrequency ();
+
+        LOG_INFO ("Map build: %dx%d in %.1f us", level->w, level->h, us);
+    }
+}
+
+/*
+ * Read and parse a map file. The returned level lives in tmp, which the
+ * caller frees once it's done with it.
+ */
+static bool
+map_read (const char *path, struct arena *tmp, struct level *level)
+{
+    bool ok = false;
+    FILE *f = fopen (path, "rb");
+
+    if (!f)
+    {
+        LOG_WARN ("Failed to open map");
+        return false;
+    }
+
+    fseek (f, 0, SEEK_END);
+    long len = ftell (f);
+    fseek (f, 0, SEEK_SET);
+
+    if (len > 0)
+    {
+        // every cell is at least one digit, so len bytes is plenty for both
+        arena_init (tmp, 2 * (size_t) len + 2 * ARENA_ALIGN);
+
+        char *text = ARENA_PUSH_ARRAY (tmp, char, len);
+        if (fread (text, 1, len, f) == (size_t) len)
+        {
+            ok = level_parse (level, text, len, tmp);
+        }
+    }
+
+    fclose (f);
+
+    if (!ok)
+    {
+        LOG_WARN ("Failed to parse map, keeping the current one");
+        arena_free (tmp);
+    }
+
+    return ok;
+}
+
+static void
+map_watch_init (struct game *game)
+{
+    char dir[MAX_PATH] = ".";
+    const char *slash = strrchr (game->map_path, '\\');
+
+    if (!slash)
+    {
+        slash = strrchr (game->map_path, '/');
+    }
+
+    if (slash)
+    {
+        int len = MIN ((int) (slash - game->map_path), MAX_PATH - 1);
+        memcpy (dir, game->map_path, len);
+        dir[len] = '\0';
+    }
+
+    game->map_watch = FindFirstChangeNotificationA (dir, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (game->map_watch == INVALID_HANDLE_VALUE)
+    {
+        LOG_WARN ("Failed to watch map directory, hot-reload disabled");
+        game->map_watch = NULL;
+    }
+}
+
+/*
+ * Non-blocking; called once per frame.
+ */
+static void
+map_watch_poll (struct game *game)
+{
+    if (game->map_watch && WaitForSingleObject (game->map_watch, 0) == WAIT_OBJECT_0)
+    {
+        struct arena tmp = {0};
+        struct level level;
+
+        FindNextChangeNotification (game->map_watch);
+
+        if (map_read (game->map_path, &tmp, &level))
+        {
+            world_load (game, &level);
+        }
+
+        arena_free (&tmp);
+    }
+}
+
+
+/*
+ * SDL stamps events with SDL_GetTicks () when it queues them; carry that
+ * over to the performance counter so latency includes the time queued.
+ */
+static u64
+event_time (SDL_Event *e)
+{
+    u32 age_ms = SDL_GetTicks () - e->common.timestamp;
+
+    return SDL_GetPerformanceCounter () - (u64) age_ms * SDL_GetPerformanceFrequency () / 1000;
+}
+
+/*
+ * Returns true when the event changed what's on screen, so the frame should
+ * be presented now rather than at the next tick.
+ */
+static bool
+handle_event (struct game *game, SDL_Event *e)
+{
+    bool redraw = false;
+
+    switch (e->type)
+    {
+        case SDL_QUIT:
+            LOG_INFO ("quit");
+            running = false;
+            break;
+        case SDL_RENDER_TARGETS_RESET:
+        case SDL_RENDER_DEVICE_RESET:
+            game->layer_stale = true;
+            redraw = true;
+            break;
+        case SDL_KEYDOWN:
+            if (!game->input_time)
+            {
+                game->input_time = event_time (e);
+            }
+
+            if (e->key.keysym.sym == SDLK_ESCAPE)
+            {
+                LOG_INFO ("esc");
+                running = false;
+            }
+            else if (e->key.keysym.sym == SDLK_F1)
+            {
+                game->hud.visible = !game->hud.visible;
+                redraw = true;
+            }
+            else if (e->key.keysym.sym == SDLK_F2)
+            {
+                game->debug_visible = !game->debug_visible;
+                redraw = true;
+            }
+            break;
+    }
+
+    return redraw;
+}
+
+/*
+ * Returns true if any event needs presenting.
+ */
+static bool
+handle_input (struct game *game)
+{
+    SDL_Event e;
+    bool redraw = false;
+
+    while (SDL_PollEvent (&e) != 0)
+    {
+        redraw |= handle_event (game, &e);
+    }
+
+    return redraw;
+}
+
+/*
+ * Sleep in the event queue until the deadline instead of a blind delay.
+ * Returns true, early, when an event needs presenting.
+ */
+static bool
+wait_input (struct game *game, u64 deadline)
+{
+    SDL_Event e;
+
+    while (running)
+    {
+        u64 now = SDL_GetPerformanceCounter ();
+        u64 frequency = SDL_GetPerformanceFrequency ();
+
+        if (now >= deadline)
+        {
+            break;
+        }
+
+        // rounded up: returning with a fraction of a ms left would spin the caller
+        int ms = (int) (((deadline - now) * 1000 + frequency - 1) / frequency);
+
+        if (SDL_WaitEventTimeout (&e, ms) && handle_event (game, &e))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#if 0
+static void
+draw_rect (struct game *game, int x, int y, u32 colour)
+{
+
+    // map = 18x18 blocks
+    // window is 800x600 pixels
+    //
+    // block = 30 pixels
+    // 18 * 30 = 540
+    int window_half_w = WINDOW_WIDTH / 2;
+    int map_size = 18 * 30;
+    int map_half_w = map_size / 2;
+    int offset = window_half_w - map_half_w;
+
+    u32 *ptr = &game->buffer[offset + y * WINDOW_WIDTH + x];
+    *ptr = colour;
+}
+#endif
+
+static void
+draw_circle (SDL_Renderer *renderer, float centreX, float centreY, float radius)
+{
+    const float diameter = (radius * 2);
+
+    float x = (radius - 1);
+    float y = 0;
+    float tx = 1;
+    float ty = 1;
+    float error = (tx - diameter);
+
+    while (x >= y)
+    {
+        //  Each of the following renders an octant of the circle
+        SDL_RenderDrawPoint (renderer, centreX + x, centreY - y);
+        SDL_RenderDrawPoint (renderer, centreX + x, centreY + y);
+        SDL_RenderDrawPoint (renderer, centreX - x, centreY - y);
+        SDL_RenderDrawPoint (renderer, centreX - x, centreY + y);
+        SDL_RenderDrawPoint (renderer, centreX + y, centreY - x);
+        SDL_RenderDrawPoint (renderer, centreX + y, centreY + x);
+        SDL_RenderDrawPoint (renderer, centreX - y, centreY - x);
+        SDL_RenderDrawPoint (renderer, centreX - y, centreY + x);
+
+        if (error <= 0)
+        {
+            ++y;
+            error += ty;
+            ty += 2;
+        }
+
+        if (error > 0)
+        {
+            --x;
+            tx += 2;
+            error += (tx - diameter);
+        }
+    }
+}
+
+static void
+draw_circle_filled (SDL_Renderer *renderer, float centreX, float centreY, float radius)
+{
+    int r2 = radius * radius;
+    int area = r2 << 2;
+    int rr = radius * 2;
+
+    // Brute force fill
+    for (int i = 0; i < area; i++)
+    {
+        int tx = (i % rr) - radius;
+        int ty = (i / rr) - radius;
+
+        if (tx * tx + ty * ty <= r2)
+        {
+            SDL_RenderDrawPoint (renderer, centreX + tx, centreY + ty);
+        }
+    }
+}
+
+static void
+debug_draw_circle (b2Transform xfrm, float radius, b2HexColor color, void *context)
+{
+    struct game *game = context;
+    b2Vec2 p = xfrm.p;
+
+    LOG_TRACE ("%s> p=%.02f,%.02f radius=%.02f", __func__, p.x, p.y, radius);
+    draw_circle_filled (game->renderer, (p.x + radius) * BLOCK_SIZE_PX, (p.y + radius) * BLOCK_SIZE_PX, radius * BLOCK_SIZE_PX);
+}
+
+static void
+draw_rect (SDL_Renderer *r, v2 topleft, v2 extent, int color)
+{
+    SDL_Rect rect = {
+        .x = topleft.x * BLOCK_SIZE_PX,
+        .y = topleft.y * BLOCK_SIZE_PX,
+        .w = extent.w * BLOCK_SIZE_PX,
+        .h = extent.h * BLOCK_SIZE_PX
+    };
+    int red   = (color & 0x00FF0000) >> 16;
+    int green = (color & 0x0000FF00) >> 8;
+    int blue  = (color & 0x000000FF) >> 0;
+    int alpha = 0xFF;
+
+    SDL_SetRenderDrawColor (r, red, green, blue, alpha);
+    SDL_RenderFillRect (r, &rect);
+}
+
+static void
+debug_draw_poly (b2Transform xfrm, const b2Vec2* vertices, int vertexCount, float radius, b2HexColor color, void* context)
+{
+    struct game *game = context;
+    b2Vec2 p = xfrm.p;
+
+    ASSERT (vertexCount == 4);
+
+    // chunk bodies hold boxes offset from the body, vertices[0] is the min corner
+    v2 topleft = {
+        .x = p.x + vertices[0].x + 0.5f,
+        .y = p.y + vertices[0].y + 0.5f,
+    };
+    v2 extent = {
+        .w = vertices[2].x - vertices[0].x,
+        .h = vertices[2].y - vertices[0].y,
+    };
+
+    draw_rect (game->renderer, topleft, extent, color);
+}
+
+/*
+ * Box2D backend: walls and balls are bodies. Blocks are only solid for one
+ * team, so instead of being bodies they're swept against on the grid after
+ * each step.
+ */
+static void
+box2d_init (struct game *game)
+{
+    b2Version version = b2GetVersion ();
+    LOG_INFO ("Initialising Box2D (v%d.%d.%d)", version.major, version.minor, version.revision);
+
+    b2WorldDef world_def = b2DefaultWorldDef ();
+    world_def.gravity = (b2Vec2) { 0.0f, 10.0f };
+    game->world_id = b2CreateWorld (&world_def);
+}
+
+static void
+box2d_shutdown (struct game *game)
+{
+    b2DestroyWorld (game->world_id);
+}
+
+static void
+box2d_add (struct game *game, struct entity *e)
+{
+    b2BodyDef body_def = b2DefaultBodyDef ();
+    body_def.position = (b2Vec2) { e->pos.x, e->pos.y };
+    body_def.type = b2_dynamicBody;
+    body_def.gravityScale = 0.0f;
+    body_def.linearVelocity.x = e->velocity.x;
+    body_def.linearVelocity.y = e->velocity.y;
+    e->body_id = b2CreateBody (game->world_id, &body_def);
+
+    b2Circle circle;
+//        circle.center = (b2Vec2) { x, y };
+    circle.radius = 0.5f;
+    b2ShapeDef shape_def = b2DefaultShapeDef ();
+    shape_def.density = 1.0f;
+    shape_def.friction = 0.0f;
+    shape_def.restitution = 1.0f;
+    shape_def.filter.groupIndex = -1; // balls pass through each other
+    b2CreateCircleShape (e->body_id, &shape_def, &circle);
+}
+
+static void
+box2d_remove (struct game *game, struct entity *e)
+{
+    if (B2_IS_NON_NULL (e->body_id))
+    {
+        b2DestroyBody (e->body_id);
+        e->body_id = b2_nullBodyId;
+    }
+}
+
+static b2Polygon
+make_box (float hx, float hy, b2Vec2 centre)
+{
+    b2Polygon box = b2MakeBox (hx, hy);
+
+    for (int i = 0; i < box.count; i++)
+    {
+        box.vertices[i].x += centre.x;
+        box.vertices[i].y += centre.y;
+    }
+    box.centroid.x += centre.x;
+    box.centroid.y += centre.y;
+
+    return box;
+}
+
+/*
+ * One static body per chunk with a box shape for each of its walls, or for
+ * each merged rectangle when the level came from a table.
+ */
+static void
+box2d_chunk_load (struct game *game, int cx, int cy)
+{
+    u32 index = cy * game->chunks_w + cx;
+    struct chunk *chunk = &game->chunks[index];
+    int x0 = cx << CHUNK_SHIFT;
+    int y0 = cy << CHUNK_SHIFT;
+
+    chunk->body_id = b2_nullBodyId;
+
+    if (game->wall_rects)
+    {
+        u32 first = game->chunk_rects[index];
+        u32 last = game->chunk_rects[index + 1];
+
+        if (first < last)
+        {
+            b2BodyDef body_def = b2DefaultBodyDef ();
+            b2ShapeDef shape_def = b2DefaultShapeDef ();
+
+            body_def.position = (b2Vec2) { x0, y0 };
+            chunk->body_id = b2CreateBody (game->world_id, &body_def);
+
+            for (u32 i = first; i < last; i++)
+            {
+                const struct level_rect *rect = &game->wall_rects[i];
+                b2Polygon box = make_box (0.5f * rect->w, 0.5f * rect->h,
+                                          (b2Vec2) { rect->x + 0.5f * (rect->w - 1), rect->y + 0.5f * (rect->h - 1) });
+
+                b2CreatePolygonShape (chunk->body_id, &shape_def, &box);
+            }
+        }
+        return;
+    }
+
+    for (int y = y0; y < MIN (y0 + CHUNK_SIZE, game->map_h); y++)
+    {
+        for (int x = x0; x < MIN (x0 + CHUNK_SIZE, game->map_w); x++)
+        {
+            if (game->tiles[y * game->map_w + x] != TILE_WALL)
+            {
+                continue;
+            }
+
+            if (B2_IS_NULL (chunk->body_id))
+            {
+                b2BodyDef body_def = b2DefaultBodyDef ();
+                body_def.position = (b2Vec2) { x0, y0 };
+                chunk->body_id = b2CreateBody (game->world_id, &body_def);
+            }
+
+            b2Polygon box = make_box (0.5f, 0.5f, (b2Vec2) { x - x0, y - y0 });
+            b2ShapeDef shape_def = b2DefaultShapeDef ();
+            b2CreatePolygonShape (chunk->body_id, &shape_def, &box);
+        }
+    }
+}
+
+static void
+box2d_chunk_unload (struct game *game, int cx, int cy)
+{
+    struct chunk *chunk = &game->chunks[cy * game->chunks_w + cx];
+
+    if (B2_IS_NON_NULL (chunk->body_id))
+    {
+        b2DestroyBody (chunk->body_id);
+        chunk->body_id = b2_nullBodyId;
+    }
+}
+
+static void
+box2d_step (struct game *game, float dt)
+{
+    struct sim_grid grid = game_grid (game);
+
+    b2World_Step (game->world_id, dt, game->sub_step_count);
+
+    for (u32 i = 0; i < game->balls.high_water; i++)
+    {
+        if (!pool_alive (&game->balls, i))
+        {
+            continue;
+        }
+
+        struct entity *e = pool_at (&game->balls, i);
+        b2Vec2 p = b2Body_GetPosition (e->body_id);
+        b2Vec2 v = b2Body_GetLinearVelocity (e->body_id);
+        v2 from = v2_addf (e->pos, e->radius);
+        v2 delta = v2_sub ((v2) { p.x, p.y }, e->pos);
+        struct sim_hit hit;
+
+        e->pos = (v2) { p.x, p.y };
+        e->velocity = (v2) { v.x, v.y };
+
+        // blocks aren't bodies, sweep this step's motion against own-team blocks
+        if (sim_sweep (&grid, from, delta, e->radius, e->team, false, &hit))
+        {
+            v2 centre = v2_add (from, v2_mulf (delta, hit.t));
+            centre = v2_add (centre, v2_mulf (hit.normal, SIM_SKIN));
+
+            e->pos = v2_addf (centre, -e->radius);
+            e->velocity = v2_reflect (e->velocity, hit.normal);
+            blocks_flipped (game, e->team, sim_tile_hit (&grid, hit.cell, e->team));
+
+            b2Body_SetTransform (e->body_id, (b2Vec2) { e->pos.x, e->pos.y }, b2Rot_identity);
+            b2Body_SetLinearVelocity (e->body_id, (b2Vec2) { e->velocity.x, e->velocity.y });
+        }
+    }
+
+    game_grid_done (game, &grid);
+}
+
+static void
+box2d_draw (struct game *game)
+{
+    b2World_Draw (game->world_id, &game->debug_draw);
+}
+
+static void
+box2d_profile (struct game *game, struct physics_profile *profile)
+{
+    b2Profile p = b2World_GetProfile (game->world_id);
+    b2Counters c = b2World_GetCounters (game->world_id);
+
+    *profile = (struct physics_profile) {
+        .step = p.step,
+        .collide = p.collide,
+        .solve = p.solve,
+        .broadphase = p.broadphase,
+        .bodies = c.bodyCount,
+        .contacts = c.contactCount,
+        .tasks = c.taskCount,
+    };
+}
+
+static const struct physics_backend box2d_backend = {
+    .name = "box2d",
+    .init = box2d_init,
+    .shutdown = box2d_shutdown,
+    .add = box2d_add,
+    .remove = box2d_remove,
+    .chunk_load = box2d_chunk_load,
+    .chunk_unload = box2d_chunk_unload,
+    .step = box2d_step,
+    .draw = box2d_draw,
+    .profile = box2d_profile,
+};
+
+/*
+ * Grid backend: balls are swept through the tile grid directly. The grid is
+ * already the compact form, so there's nothing to build or drop.
+ */
+static void
+grid_init (struct game *game)
+{
+}
+
+static void
+grid_shutdown (struct game *game)
+{
+}
+
+static void
+grid_add (struct game *game, struct entity *e)
+{
+}
+
+static void
+grid_remove (struct game *game, struct entity *e)
+{
+}
+
+static void
+grid_chunk_load (struct game *game, int cx, int cy)
+{
+}
+
+static void
+grid_chunk_unload (struct game *game, int cx, int cy)
+{
+}
+
+static void
+grid_step (struct game *game, float dt)
+{
+    struct sim_grid grid = game_grid (game);
+
+    for (u32 i = 0; i < game->balls.high_water; i++)
+    {
+        if (!pool_alive (&game->balls, i))
+        {
+            continue;
+        }
+
+        struct entity *e = pool_at (&game->balls, i);
+        v2 centre = v2_addf (e->pos, e->radius);
+
+        blocks_flipped (game, e->team, sim_move_ball (&grid, &centre, &e->velocity, e->radius, e->team, dt));
+        e->pos = v2_addf (centre, -e->radius);
+    }
+
+    game_grid_done (game, &grid);
+}
+
+static const struct physics_backend grid_backend = {
+    .name = "grid",
+    .init = grid_init,
+    .shutdown = grid_shutdown,
+    .add = grid_add,
+    .remove = grid_remove,
+    .chunk_load = grid_chunk_load,
+    .chunk_unload = grid_chunk_unload,
+    .step = grid_step,
+};
+
+/*
+ * Draw the given cells, or every visible one when cells is NULL, to the
+ * current render target.
+ */
+static void
+tiles_visible (struct game *game, int *w, int *h)
+{
+    *w = MIN (game->map_w, WINDOW_WIDTH / BLOCK_SIZE_PX + 1);
+    *h = MIN (game->map_h, WINDOW_HEIGHT / BLOCK_SIZE_PX + 1);
+}
+
+/*
+ * Callers keep n_cells to at most the visible tiles, so the scratch pushes
+ * stay small.
+ */
+static void
+render_tiles (struct game *game, const u32 *cells, u32 n_cells)
+{
+    /*
+     * Batch tiles by team colour into per-frame scratch memory so each
+     * colour is a single SDL_RenderFillRects () call.
+     */
+    int visible_w, visible_h;
+    tiles_visible (game, &visible_w, &visible_h);
+    u32 n = cells ? n_cells : (u32) (visible_w * visible_h);
+    SDL_Rect *rects[3];
+    int n_rects[3] = {0};
+
+    for (int t = 0; t < LEN (rects); t++)
+    {
+        rects[t] = ARENA_PUSH_ARRAY (&game->scratch, SDL_Rect, n);
+
+        if (!rects[t])
+        {
+            LOG_WARN ("Out of scratch memory for the tiles");
+            return;
+        }
+    }
+
+    for (u32 i = 0; i < n; i++)
+    {
+        int x = cells ? (int) (cells[i] % game->map_w) : (int) (i % visible_w);
+        int y = cells ? (int) (cells[i] / game->map_w) : (int) (i / visible_w);
+        u8 tile = game->tiles[y * game->map_w + x];
+
+        if (tile && x < visible_w && y < visible_h)
+        {
+            int team = TILE_TYPE (tile) == TILE_WALL ? E_TEAM_NONE : TILE_TEAM (tile);
+
+            rects[team][n_rects[team]++] = (SDL_Rect) {
+                .x = x * BLOCK_SIZE_PX,
+                .y = y * BLOCK_SIZE_PX,
+                .w = BLOCK_SIZE_PX,
+                .h = BLOCK_SIZE_PX
+            };
+        }
+    }
+
+    SDL_SetRenderDrawColor (game->renderer, 0xFF, 0x11, 0x11, 0xFF);
+    SDL_RenderFillRects (game->renderer, rects[E_TEAM_NONE], n_rects[E_TEAM_NONE]);
+    SDL_SetRenderDrawColor (game->renderer, 0xEE, 0xEE, 0xEE, 0xFF);
+    SDL_RenderFillRects (game->renderer, rects[E_TEAM_LIGHT], n_rects[E_TEAM_LIGHT]);
+    SDL_SetRenderDrawColor (game->renderer, 0x33, 0x33, 0x33, 0xFF);
+    SDL_RenderFillRects (game->renderer, rects[E_TEAM_DARK], n_rects[E_TEAM_DARK]);
+}
+
+/*
+ * Walls never change and blocks only when they flip, so the tiles are kept
+ * in a render target: a new tick redraws just the cells in the flip log and
+ * every frame is one copy. A reloaded map, an overflowed flip log or lost
+ * targets redraw the lot, as does a tick with more flips than visible tiles.
+ */
+static void
+render_tile_layer (struct game *game)
+{
+    if (!game->tile_layer)
+    {
+        render_tiles (game, NULL, 0);
+        return;
+    }
+
+    if (game->layer_stale || game->layer_tick != game->tick)
+    {
+        int visible_w, visible_h;
+        tiles_visible (game, &visible_w, &visible_h);
+
+        // past a screenful of flips, redrawing the screen is cheaper anyway
+        bool all = game->layer_stale || game->n_flipped > game->max_flipped ||
+                   game->n_flipped > (u32) (visible_w * visible_h) ||
+                   game->layer_tick + 1 != game->tick;
+
+        SDL_SetRenderTarget (game->renderer, game->tile_layer);
+
+        if (all)
+        {
+            SDL_SetRenderDrawColor (game->renderer, 0x00, 0x00, 0x00, 0xFF);
+            SDL_RenderClear (game->renderer);
+            render_tiles (game, NULL, 0);
+        }
+        else
+        {
+            render_tiles (game, game->flipped, game->n_flipped);
+        }
+
+        SDL_SetRenderTarget (game->renderer, NULL);
+        game->layer_tick = game->tick;
+        game->layer_stale = false;
+    }
+
+    SDL_RenderCopy (game->renderer, game->tile_layer, NULL, NULL);
+}
+
+static void
+draw_ball (struct game *game, v2 centre, float radius, enum team team)
+{
+    if (team == E_TEAM_LIGHT)
+    {
+        SDL_SetRenderDrawColor (game->renderer, 0xEE, 0xEE, 0xEE, 0xFF);
+    }
+    else if (team == E_TEAM_DARK)
+    {
+        SDL_SetRenderDrawColor (game->renderer, 0x33, 0x33, 0x33, 0xFF);
+    }
+    else
+    {
+        SDL_SetRenderDrawColor (game->renderer, 0xFF, 0x11, 0x11, 0xFF);
+    }
+
+    draw_circle_filled (game->renderer, centre.x * BLOCK_SIZE_PX, centre.y * BLOCK_SIZE_PX, radius * BLOCK_SIZE_PX);
+}
+
+static void
+render (struct game *game)
+{
+    render_tile_layer (game);
+
+    for (u32 i = 0; i < game->balls.high_water; i++)
+    {
+        if (!pool_alive (&game->balls, i))
+        {
+            continue;
+        }
+
+        struct entity *e = pool_at (&game->balls, i);
+
+        LOG_TRACE ("%s> player: p=%.02f %.02f v=%.02f %.02f", __func__, e->pos.x, e->pos.y, e->velocity.x, e->velocity.y);
+        draw_ball (game, v2_addf (e->pos, e->radius), e->radius, e->team);
+    }
+}
+
+/*
+ * F1 toggles it. Percentiles are over the last HUD_SAMPLES frames, rates
+ * over the last second.
+ */
+static void
+render_hud (struct game *game)
+{
+    struct hud *hud = &game->hud;
+    SDL_Renderer *r = game->renderer;
+    struct physics_profile profile;
+    bool has_profile = game->physics->profile != NULL;
+
+    if (has_profile)
+    {
+        game->physics->profile (game, &profile);
+    }
+
+    hud_begin (hud, r, has_profile ? 7 : 5, 48);
+
+    hud_line (hud, r, "frame ms p50 %5.2f p95 %5.2f p99 %5.2f", hud->frame.p50, hud->frame.p95, hud->frame.p99);
+    hud_line (hud, r, "work  ms p50 %5.2f p95 %5.2f p99 %5.2f", hud->work.p50, hud->work.p95, hud->work.p99);
+    hud_line (hud, r, "input ms p50 %5.2f p95 %5.2f p99 %5.2f", hud->input.p50, hud->input.p95, hud->input.p99);
+    hud_line (hud, r, "tps %.0f  flips/s %.0f  %s %.2f ms", hud->tps, hud->flips_per_second, game->physics->name, game->step_ms);
+
+    if (has_profile)
+    {
+        hud_line (hud, r, "collide %.2f solve %.2f broadphase %.2f", profile.collide, profile.solve, profile.broadphase);
+        hud_line (hud, r, "bodies %d  contacts %d  tasks %d", profile.bodies, profile.contacts, profile.tasks);
+    }
+
+    hud_line (hud, r, "balls %u  chunks %u/%d  tiles %dx%d",
+            game->balls.count, game->n_loaded, game->chunks_w * game->chunks_h, game->map_w, game->map_h);
+}
+
+static void *
+box2d_alloc (unsigned int size, int alignment)
+{
+    return heap_alloc (size, alignment);
+}
+
+static void
+box2d_free (void *mem)
+{
+    heap_free (mem);
+}
+
+static void
+signal_handler (int signal)
+{
+    printf ("signal received: %d\n", signal);
+    switch (signal)
+    {
+        case SIGINT:
+            running = false;
+            break;
+        case SIGSEGV:
+            printf ("SEGMENTATION FAULT\n");
+            stack_trace ();
+            running = false;
+            break;
+    }
+}
+
+/*
+ * Everything both the game and the benchmarks need.
+ */
+static void
+init (struct game *game)
+{
+    srand (GAME_SEED); // Use the same seed
+
+    log_init ();
+
+    ASSERT (signal (SIGINT, signal_handler) != SIG_ERR &&
+            signal (SIGSEGV, signal_handler) != SIG_ERR);
+
+    /*
+     * One heap block for the lifetime of the game with the per-frame scratch
+     * arena carved out of it. The level arena is sized by the map.
+     */
+    arena_init (&game->arena, ARENA_SIZE);
+    arena_init_sub (&game->scratch, &game->arena, SCRATCH_ARENA_SIZE);
+
+    game->buffer = ARENA_PUSH_ARRAY (&game->arena, u32, WINDOW_WIDTH * WINDOW_HEIGHT);
+    game->dt = 1.0f / 60.0f;
+    game->sub_step_count = 4;
+    game->pitch = sizeof (u32) * WINDOW_WIDTH; // u32 is 4 bytes :'(
+
+    if (!game->physics)
+    {
+        game->physics = &box2d_backend;
+    }
+
+    b2SetAllocator (box2d_alloc, box2d_free);
+}
+
+static void
+init_video (struct game *game)
+{
+    LOG_INFO ("Initialising SDL");
+
+    SDL_Init (SDL_INIT_VIDEO);
+    game->window = SDL_CreateWindow ("auto-pong",
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            WINDOW_WIDTH, WINDOW_HEIGHT,
+            SDL_WINDOW_BORDERLESS);
+    ASSERT (game->window);
+
+    game->renderer = SDL_CreateRenderer (game->window, -1, SDL_RENDERER_ACCELERATED);
+    ASSERT (game->renderer);
+
+    game->texture = SDL_CreateTexture (game->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            WINDOW_WIDTH, WINDOW_HEIGHT);
+    ASSERT (game->texture);
+
+    game->tile_layer = SDL_CreateTexture (game->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_TARGET,
+            WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!game->tile_layer)
+    {
+        // fixed text: the logger only keeps the pointer and SDL_GetError's buffer gets reused
+        LOG_WARN ("No render target for the tile layer, drawing tiles every frame");
+    }
+    game->layer_stale = true;
+
+    if (!hud_init (&game->hud, game->renderer))
+    {
+        LOG_WARN ("Failed to create the HUD atlas");
+    }
+
+    // TODO: draw outlines instead?
+    game->debug_draw = (b2DebugDraw) {
+        .DrawSolidCircle = debug_draw_circle,
+        .DrawSolidPolygon = debug_draw_poly,
+        .useDrawingBounds = false,
+        .drawShapes = true,
+        .context = game,
+    };
+}
+
+static void
+init_world (struct game *game)
+{
+    LOG_INFO ("Physics: %s", game->physics->name);
+    game->physics->init (game);
+
+    LOG_INFO ("Loading map");
+
+    struct arena tmp = {0};
+    struct level level;
+
+    if (game->gen.w > 0)
+    {
+        arena_init (&tmp, (size_t) game->gen.w * game->gen.h + ARENA_ALIGN);
+
+        u64 start = SDL_GetPerformanceCounter ();
+        ASSERT (mapgen (&level, &game->gen, &tmp));
+        double ms = (SDL_GetPerformanceCounter () - start) * 1e3 / SDL_GetPerformanceFrequency ();
+
+        LOG_INFO ("Generated %dx%d map (seed %llu) in %.1f ms", level.w, level.h, game->gen.seed, ms);
+        world_load (game, &level);
+    }
+    else if (game->map_path && map_read (game->map_path, &tmp, &level))
+    {
+        world_load (game, &level);
+        map_watch_init (game);
+    }
+    else
+    {
+        u64 start = SDL_GetPerformanceCounter ();
+        world_build_table (game, game->embedded);
+        double us = (SDL_GetPerformanceCounter () - start) * 1e6 / SDL_GetPerformanceFrequency ();
+
+        LOG_INFO ("Map build: %dx%d in %.1f us", game->map_w, game->map_h, us);
+        game->layer_stale = true;
+    }
+
+    arena_free (&tmp);
+}
+
+/*
+ * Headless ticks per second of each physics backend at the same ball counts.
+ */
+static void
+bench_physics (struct game *game)
+{
+    const struct physics_backend *backends[] = { &box2d_backend, &grid_backend };
+    int ball_counts[] = { 16, 256, 4096 };
+
+    printf ("%-8s %8s %12s %10s %12s\n", "backend", "balls", "ticks/s", "flips", "chunks");
+
+    for (int i = 0; i < LEN (ball_counts); i++)
+    {
+        struct arena tmp = {0};
+        struct level level;
+
+        // a light and a dark half, with the balls spread over the half they play in
+        struct mapgen_params params = mapgen_defaults (BENCH_MAP_SIZE, BENCH_MAP_SIZE, GAME_SEED);
+        params.wall_density = 0.0f;
+        params.n_balls = ball_counts[i] / 2;
+
+        arena_init (&tmp, BENCH_MAP_SIZE * BENCH_MAP_SIZE + KILOBYTES (1));
+        mapgen (&level, &params, &tmp);
+
+        for (int b = 0; b < LEN (backends); b++)
+        {
+            game->physics = backends[b];
+            game->physics->init (game);
+            game->flips = 0;
+
+            srand (GAME_SEED);
+            world_build (game, &level);
+
+            u64 start = SDL_GetPerformanceCounter ();
+            for (int tick = 0; tick < BENCH_TICKS; tick++)
+            {
+                world_step (game, game->dt);
+            }
+            double seconds = (double) (SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
+
+            printf ("%-8s %8d %12.0f %10llu %8u/%u\n", game->physics->name, ball_counts[i],
+                    BENCH_TICKS / seconds, game->flips, game->n_loaded, game->chunks_w * game->chunks_h);
+
+            world_clear (game);
+            game->physics->shutdown (game);
+        }
+
+        arena_free (&tmp);
+    }
+}
+
+/*
+ * Physics step time on maps where nearly every block belongs to the team
+ * the balls pass through, sweeping tile by tile and through the occupancy
+ * planes.
+ */
+static void
+bench_team (struct game *game)
+{
+    const struct physics_backend *backends[] = { &grid_backend, &box2d_backend };
+    int ball_counts[] = { 256, 4096 };
+
+    printf ("%-8s %8s %12s %12s %8s\n", "backend", "balls", "tiles us", "masked us", "speedup");
+
+    for (int i = 0; i < LEN (ball_counts); i++)
+    {
+        struct arena tmp = {0};
+        struct level level;
+        struct mapgen_params params = mapgen_defaults (BENCH_MAP_SIZE, BENCH_MAP_SIZE, GAME_SEED);
+
+        params.n_balls = ball_counts[i] / 2;
+
+        arena_init (&tmp, BENCH_MAP_SIZE * BENCH_MAP_SIZE + KILOBYTES (1));
+        mapgen (&level, &params, &tmp);
+
+        // LIGHT balls only, which pass through DARK blocks
+        for (int c = 0; c < level.w * level.h; c++)
+        {
+            u8 *cell = &level.cells[c];
+
+            if (TILE_TYPE (*cell) == TILE_PLAYER)
+            {
+                *cell = TILE_PLAYER | TILE_LIGHT;
+            }
+            else if (TILE_TYPE (*cell) == TILE_BLOCK)
+            {
+                *cell = TILE_BLOCK | (mapgen_mix (c) % BENCH_OWN_BLOCKS ? TILE_DARK : TILE_LIGHT);
+            }
+        }
+
+        for (int b = 0; b < LEN (backends); b++)
+        {
+            double step_us[2] = {0};
 
-            if (hit)
+            for (int masked = 0; masked < 2; masked++)
             {
-                collision_resolve (p, hit, &collision);
-                break;
+                game->physics = backends[b];
+                game->physics->init (game);
+
+                srand (GAME_SEED);
+                world_build (game, &level);
+
+                if (!masked)
+                {
+                    game->occupancy = NULL;
+                }
+
+                for (int tick = 0; tick < BENCH_TICKS; tick++)
+                {
+                    world_step (game, game->dt);
+                    step_us[masked] += game->step_ms * 1e3 / BENCH_TICKS;
+                }
+
+                world_clear (game);
+                game->physics->shutdown (game);
             }
+
+            printf ("%-8s %8d %12.1f %12.1f %7.2fx\n", backends[b]->name, ball_counts[i],
+                    step_us[0], step_us[1], step_us[0] / step_us[1]);
         }
 
-        p->pos.x += p->velocity.x * game->dt;
-        p->pos.y += p->velocity.y * game->dt;
+        arena_free (&tmp);
     }
 }
 
+/*
+ * Map generation time by size, default parameters.
+ */
 static void
-render (struct game *game)
+bench_mapgen (void)
 {
-    for (int i = 0; i < game->n_entities; i++)
+    int sizes[] = { 1024, 4096, 16384 };
+    SYSTEM_INFO info;
+
+    // timings scale with the thread count, say what this was
+    GetSystemInfo (&info);
+    printf ("mapgen on %u processors, at most %d threads\n", (u32) info.dwNumberOfProcessors, MAPGEN_MAX_THREADS);
+    printf ("%8s %10s %10s\n", "size", "ms", "Mcells/s");
+
+    for (int i = 0; i < LEN (sizes); i++)
     {
-        struct entity *e = &game->entities[i];
-        if (e->type != E_TYPE_BALL)
-        {
-            draw_entity (game, e);
-        }
+        struct mapgen_params params = mapgen_defaults (sizes[i], sizes[i], GAME_SEED);
+        struct arena tmp = {0};
+        struct level level;
+
+        params.n_balls = sizes[i];
+        arena_init (&tmp, (size_t) sizes[i] * sizes[i] + ARENA_ALIGN);
+
+        u64 start = SDL_GetPerformanceCounter ();
+        ASSERT (mapgen (&level, &params, &tmp));
+        double seconds = (double) (SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
+
+        printf ("%8d %10.1f %10.0f\n", sizes[i], seconds * 1e3, (double) sizes[i] * sizes[i] / seconds / 1e6);
+
+        arena_free (&tmp);
     }
+}
+
+/*
+ * Startup of each embedded level, decoding u32 cells at run time as the
+ * map.h path used to against copying the mapc tables, up to the chunks
+ * around the balls being materialised.
+ */
+static void
+bench_load (struct game *game)
+{
+    const struct physics_backend *backends[] = { &box2d_backend, &grid_backend };
+
+    printf ("%-8s %-8s %12s %12s %8s\n", "level", "backend", "decode ms", "table ms", "speedup");
 
-    for (int i = 0; i < game->n_players; i++)
+    for (int t = 0; t < LEN (levels); t++)
     {
-        struct entity *e = game->players[i];
+        const struct level_table *table = levels[t];
+        size_t n = (size_t) table->w * table->h;
+        u32 *cells = heap_alloc (n * sizeof (u32), ARENA_ALIGN);
 
-        if (e->team == E_TEAM_LIGHT)
+        // the u32 initialiser the level would have in map.h
+        for (size_t i = 0; i < n; i++)
         {
-            SDL_SetRenderDrawColor (game->renderer, 0xEE, 0xEE, 0xEE, 0xFF);
+            cells[i] = table->tiles[i];
         }
-        else if (e->team == E_TEAM_DARK)
+        for (u32 i = 0; i < table->n_spawns; i++)
         {
-            SDL_SetRenderDrawColor (game->renderer, 0x33, 0x33, 0x33, 0xFF);
+            cells[table->spawns[i].y * table->w + table->spawns[i].x] = TILE_PLAYER | table->spawns[i].team << 4;
         }
-        else
+
+        for (int b = 0; b < LEN (backends); b++)
         {
-            SDL_SetRenderDrawColor (game->renderer, 0xFF, 0x11, 0x11, 0xFF);
-        }
+            double seconds[2] = {0};
+
+            game->physics = backends[b];
+            game->physics->init (game);
 
-        b2Vec2 pos = b2Body_GetPosition (e->body_id);
+            for (int run = 0; run < BENCH_LOAD_RUNS; run++)
+            {
+                for (int path = 0; path < 2; path++)
+                {
+                    struct arena tmp = {0};
+                    struct level level;
+
+                    arena_init (&tmp, n + ARENA_ALIGN);
+
+                    u64 start = SDL_GetPerformanceCounter ();
+                    if (path == 0)
+                    {
+                        level_from_u32 (&level, cells, table->w, table->h, &tmp);
+                        world_build (game, &level);
+                    }
+                    else
+                    {
+                        world_build_table (game, table);
+                    }
+                    chunks_update (game);
+                    seconds[path] += (double) (SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
 
-        // printf ("%s> player: e->p=%.02f %.02f b2-pos=%.02f %.02f (id=%d)\n", __func__, e->pos.x, e->pos.y, pos.x, pos.y, e->body_id.index1);
-        draw_circle_filled (game->renderer, (pos.x + e->radius) * BLOCK_SIZE_PX, (pos.y + e->radius) * BLOCK_SIZE_PX, e->radius * BLOCK_SIZE_PX);
+                    world_clear (game);
+                    arena_free (&tmp);
+                }
+            }
+
+            printf ("%-8s %-8s %12.3f %12.3f %7.1fx\n", table->name, game->physics->name,
+                    seconds[0] * 1e3 / BENCH_LOAD_RUNS, seconds[1] * 1e3 / BENCH_LOAD_RUNS, seconds[0] / seconds[1]);
+
+            game->physics->shutdown (game);
+        }
+
+        heap_free (cells);
     }
 }
 
+/*
+ * Environment steps per second of the batched API on the built-in map.
+ */
 static void
-signal_handler (int signal)
+bench_env (void)
 {
-    printf ("signal received: %d\n", signal);
-    switch (signal)
+    int env_counts[] = { 1, 64, 1024, 8192 };
+    struct arena tmp = {0};
+    struct level level;
+
+    arena_init (&tmp, KILOBYTES (4));
+    level_from_u32 (&level, &map[0][0], LEN (map[0]), LEN (map), &tmp);
+
+    int n_balls = sim_ball_count (&level);
+
+    printf ("%8s %8s %14s %10s\n", "envs", "steps", "env-steps/s", "flips");
+
+    for (int i = 0; i < LEN (env_counts); i++)
     {
-        case SIGINT:
-            running = false;
-            break;
-        case SIGSEGV:
-            printf ("SEGMENTATION FAULT\n");
-            stack_trace ();
-            running = false;
-            break;
+        int n_envs = env_counts[i];
+        int n_steps = MAX (BENCH_ENV_STEPS / n_envs, 1);
+        struct sim_buffers buffers = {
+            .ball_pos = heap_alloc (sizeof (float) * 2 * n_balls * n_envs, 64),
+            .ball_vel = heap_alloc (sizeof (float) * 2 * n_balls * n_envs, 64),
+            .tiles = heap_alloc ((size_t) level.w * level.h * n_envs, 64),
+            .flips = heap_alloc (sizeof (u64) * n_envs, 64),
+        };
+        struct sim_batch *batch = sim_create (n_envs, &level, NULL, buffers);
+
+        ASSERT (batch);
+
+        u64 start = SDL_GetPerformanceCounter ();
+        for (int step = 0; step < n_steps; step++)
+        {
+            sim_step_batch (batch, 1, 1.0f / 60.0f);
+        }
+        double seconds = (double) (SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
+
+        u64 flips = 0;
+        for (int env = 0; env < n_envs; env++)
+        {
+            flips += buffers.flips[env];
+        }
+
+        printf ("%8d %8d %14.0f %10llu\n", n_envs, n_steps, (double) n_envs * n_steps / seconds, flips);
+
+        sim_destroy (batch);
+        heap_free (buffers.ball_pos);
+        heap_free (buffers.ball_vel);
+        heap_free (buffers.tiles);
+        heap_free (buffers.flips);
     }
+
+    arena_free (&tmp);
 }
 
+/*
+ * Replay viewer. Nothing is simulated: every frame seeks the mapped file to
+ * the tick on screen. Space pauses, left/right jump REPLAY_SEEK_TICKS,
+ * comma/period step a tick, home/end go to either end.
+ */
 static void
-init (struct game *game)
+replay_play (struct game *game, const char *path)
 {
-    srand (117); // Use the same seed
+    struct replay_view view;
 
-    ASSERT (signal (SIGINT, signal_handler) != SIG_ERR &&
-            signal (SIGSEGV, signal_handler) != SIG_ERR);
+    if (!replay_open (&view, path))
+    {
+        return;
+    }
 
-    game->buffer = (u32 *) malloc (WINDOW_WIDTH * WINDOW_HEIGHT * sizeof (u32));
-    game->dt = 1.0f / 60.0f;
-    game->sub_step_count = 4;
-    game->pitch = sizeof (u32) * WINDOW_WIDTH; // u32 is 4 bytes :'(
+    LOG_INFO ("Replay: %dx%d, seed %llu, %llu ticks, %u keyframes",
+            view.state.w, view.state.h, view.header->seed, view.n_ticks, view.n_keys);
 
-    printf ("Initialising SDL\n");
+    init_video (game);
 
-    SDL_Init (SDL_INIT_VIDEO);
-    game->window = SDL_CreateWindow ("auto-pong",
-            SDL_WINDOWPOS_CENTERED,
-            SDL_WINDOWPOS_CENTERED,
-            WINDOW_WIDTH, WINDOW_HEIGHT,
-            SDL_WINDOW_BORDERLESS);
-    ASSERT (game->window);
+    int tick = 0;
+    int last = (int) view.n_ticks - 1;
+    bool paused = false;
 
-    game->renderer = SDL_CreateRenderer (game->window, -1, SDL_RENDERER_ACCELERATED);
-    ASSERT (game->renderer);
+    running = true;
+    while (running)
+    {
+        SDL_Event e;
 
-    game->texture = SDL_CreateTexture (game->renderer,
-            SDL_PIXELFORMAT_RGBA8888,
-            SDL_TEXTUREACCESS_STREAMING,
-            WINDOW_WIDTH, WINDOW_HEIGHT);
-    ASSERT (game->texture);
+        arena_reset (&game->scratch);
 
-    b2Version version = b2GetVersion ();
-    printf ("Initialising Box2D (v%d.%d.%d)\n", version.major, version.minor, version.revision);
-    b2WorldDef world_def = b2DefaultWorldDef ();
-    world_def.gravity = (b2Vec2) { 0.0f, 10.0f };
-    game->world_id = b2CreateWorld (&world_def);
+        while (SDL_PollEvent (&e) != 0)
+        {
+            if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
+            {
+                running = false;
+            }
+            else if (e.type == SDL_KEYDOWN)
+            {
+                switch (e.key.keysym.sym)
+                {
+                    case SDLK_SPACE:  { paused = !paused; } break;
+                    case SDLK_LEFT:   { tick -= REPLAY_SEEK_TICKS; } break;
+                    case SDLK_RIGHT:  { tick += REPLAY_SEEK_TICKS; } break;
+                    case SDLK_COMMA:  { tick--; paused = true; } break;
+                    case SDLK_PERIOD: { tick++; paused = true; } break;
+                    case SDLK_HOME:   { tick = 0; } break;
+                    case SDLK_END:    { tick = last; } break;
+                }
+            }
+        }
 
-    // TODO: draw outlines instead?
-    game->debug_draw = (b2DebugDraw) {
-        .DrawSolidCircle = debug_draw_circle,
-        .DrawSolidPolygon = debug_draw_poly,
-        .useDrawingBounds = false,
-        .drawShapes = true,
-        .context = game,
-    };
+        tick = CLAMP (tick, 0, last);
 
-    printf ("Loading map\n");
-    /*
-     * Load map
-     *
-     * TODO: not sure where this should go? the bits need to be defined somewhere i guess
-     */
-    for (int y = 0; y < 18; y++)
-    {
-        for (int x = 0; x < 18; x++)
+        if (!replay_seek (&view, tick))
         {
-            unsigned int block = map[y][x];
-            u8 type = block & 0x0F;
-            u8 team = (block & 0xF0) >> 4;
+            LOG_ERROR ("Replay is corrupt at tick %d", tick);
+            break;
+        }
 
-            switch (team)
-            {
-                case 0x1:
-                    team = E_TEAM_LIGHT;
-                    break;
-                case 0x2:
-                    team = E_TEAM_DARK;
-                    break;
-            }
+        game->map_w = view.state.w;
+        game->map_h = view.state.h;
+        game->tiles = view.state.tiles;
+
+        SDL_SetRenderDrawColor (game->renderer, 0x00, 0x00, 0x00, 0xFF);
+        SDL_RenderClear (game->renderer);
+
+        render_tiles (game, NULL, 0);
 
-            switch (type)
+        for (u32 i = 0; i < view.state.n_balls; i++)
+        {
+            struct replay_ball *ball = &view.state.balls[i];
+
+            if (ball->team)
             {
-                case 0x1:
-                    add_entity (game, E_TYPE_WALL, x, y, E_TEAM_NONE);
-                    break;
-                case 0x2:
-                    add_entity (game, E_TYPE_BLOCK, x, y, team);
-                    break;
-                case 0x4:
-                    add_entity (game, E_TYPE_BALL, x, y, team);
-                    add_entity (game, E_TYPE_BLOCK, x, y, team == 0x1 ? E_TEAM_DARK : E_TEAM_LIGHT);
-                    break;
+                v2 centre = { replay_dequantise (ball->q[0]), replay_dequantise (ball->q[1]) };
+                draw_ball (game, centre, 0.5f, ball->team);
             }
         }
+
+        SDL_RenderPresent (game->renderer);
+
+        if (!paused && tick < last)
+        {
+            tick++;
+        }
+
+        SDL_Delay (FRAME_TIME_MS);
     }
 
-    printf ("Added %d entities\n", game->n_entities);
+    game->tiles = NULL;
+    replay_close (&view);
 }
 
 static void
 cleanup (struct game *game)
 {
-    b2DestroyWorld (game->world_id);
+    if (game->map_watch)
+    {
+        FindCloseChangeNotification (game->map_watch);
+    }
+
+    replay_record_end (&game->replay);
+    metrics_shutdown (&game->metrics);
+    hud_shutdown (&game->hud);
+
+    if (game->tile_layer)
+    {
+        SDL_DestroyTexture (game->tile_layer);
+    }
+
+    world_clear (game);
+    game->physics->shutdown (game);
+
+    LOG_INFO ("Heap: %llu allocs (%llu bytes), %llu after warmup over %llu ticks",
+            alloc_stats.allocs, alloc_stats.bytes, game->steady_allocs, game->tick);
+
+    if (game->hud.input.count)
+    {
+        LOG_INFO ("Input to present: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms over %u events",
+                game->hud.input.p50, game->hud.input.p95, game->hud.input.p99, game->hud.input.count);
+    }
+
+    arena_free (&game->level);
+    arena_free (&game->arena);
+    log_shutdown ();
 }
 
 int
 main (int argc, char **argv)
 {
     struct game game = {0};
+    bool bench = false;
+    bool bench_envs = false;
+    bool bench_gen = false;
+    bool bench_loads = false;
+    bool bench_teams = false;
+    struct mapgen_params gen = mapgen_defaults (0, 0, GAME_SEED);
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    u32 key_interval = REPLAY_KEY_INTERVAL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp (argv[i], "-grid") == 0)
+        {
+            game.physics = &grid_backend;
+        }
+        else if (strcmp (argv[i], "-bench") == 0)
+        {
+            bench = true;
+        }
+        else if (strcmp (argv[i], "-bench-env") == 0)
+        {
+            bench_envs = true;
+        }
+        else if (strcmp (argv[i], "-bench-gen") == 0)
+        {
+            bench_gen = true;
+        }
+        else if (strcmp (argv[i], "-bench-load") == 0)
+        {
+            bench_loads = true;
+        }
+        else if (strcmp (argv[i], "-bench-team") == 0)
+        {
+            bench_teams = true;
+        }
+        else if (strcmp (argv[i], "-level") == 0 && i + 1 < argc)
+        {
+            i++;
+            game.embedded = NULL;
+            for (int l = 0; l < LEN (levels) && !game.embedded; l++)
+            {
+                game.embedded = strcmp (argv[i], levels[l]->name) == 0 ? levels[l] : NULL;
+            }
+
+            // the logger isn't running yet
+            if (!game.embedded)
+            {
+                fprintf (stderr, "unknown level %s, expected default or large\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp (argv[i], "-gen") == 0 && i + 1 < argc)
+        {
+            if (sscanf (argv[++i], "%dx%d", &gen.w, &gen.h) != 2)
+            {
+                gen.w = gen.h = 0;
+            }
+        }
+        else if (strcmp (argv[i], "-seed") == 0 && i + 1 < argc)
+        {
+            gen.seed = strtoull (argv[++i], NULL, 10);
+        }
+        else if (strcmp (argv[i], "-density") == 0 && i + 1 < argc)
+        {
+            gen.wall_density = (float) atof (argv[++i]);
+        }
+        else if (strcmp (argv[i], "-balls") == 0 && i + 1 < argc)
+        {
+            gen.n_balls = atoi (argv[++i]);
+        }
+        else if (strcmp (argv[i], "-spawn-grid") == 0)
+        {
+            gen.spawn = MAPGEN_SPAWN_GRID;
+        }
+        else if (strcmp (argv[i], "-rotate") == 0)
+        {
+            gen.symmetry = MAPGEN_ROTATE;
+        }
+        else if (strcmp (argv[i], "-record") == 0 && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if (strcmp (argv[i], "-key-interval") == 0 && i + 1 < argc)
+        {
+            key_interval = atoi (argv[++i]);
+        }
+        else if (strcmp (argv[i], "-replay") == 0 && i + 1 < argc)
+        {
+            replay_path = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            // a mistyped flag would otherwise be opened as the map
+            fprintf (stderr, "unknown option %s, or it's missing its value\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            game.map_path = argv[i];
+        }
+    }
+
+    if (gen.w > 0)
+    {
+        game.gen = gen;
+    }
 
     init (&game);
 
+    if (!game.embedded)
+    {
+        game.embedded = &level_default;
+    }
+
+    if (bench || bench_envs || bench_gen || bench_loads || bench_teams)
+    {
+        if (bench)
+        {
+            bench_physics (&game);
+        }
+        if (bench_gen)
+        {
+            bench_mapgen ();
+        }
+        if (bench_envs)
+        {
+            bench_env ();
+        }
+        if (bench_loads)
+        {
+            bench_load (&game);
+        }
+        if (bench_teams)
+        {
+            bench_team (&game);
+        }
+        arena_free (&game.level);
+        arena_free (&game.arena);
+        log_shutdown ();
+        return 0;
+    }
+
+    if (replay_path)
+    {
+        replay_play (&game, replay_path);
+        arena_free (&game.arena);
+        log_shutdown ();
+        return 0;
+    }
+
+    init_video (&game);
+    init_world (&game);
+
+    if (metrics_init (&game.metrics))
+    {
+        LOG_INFO ("Metrics published for pid %u", (u32) GetCurrentProcessId ());
+    }
+    else
+    {
+        LOG_WARN ("Failed to create the metrics mapping");
+    }
+
+    if (record_path)
+    {
+        struct level level = { game.map_w, game.map_h, game.map };
+
+        replay_record_begin (&game.replay, record_path, &level, GAME_SEED, game.balls.capacity,
+                             game.max_flipped, key_interval, game.dt);
+    }
+
+    u64 frequency = SDL_GetPerformanceFrequency ();
+    u64 tick_counts = (u64) (FRAME_TIME_MS * frequency / 1000.0f);
+    u64 next_tick = SDL_GetPerformanceCounter ();
+    u64 last_present = next_tick;
+    double ms_per_count = 1e3 / frequency;
+    bool redraw = false;
+
+    /*
+     * Ticks run at a fixed rate. Between them the loop waits on the event
+     * queue, and an event that changes the picture is presented right away
+     * without waiting for the next tick.
+     */
     running = true;
     while (running)
     {
-        handle_input ();
+        u64 allocs = alloc_stats.allocs;
+        u64 frame_start = SDL_GetPerformanceCounter ();
+        bool tick = frame_start >= next_tick;
+
+        arena_reset (&game.scratch);
+        redraw |= handle_input (&game);
 
-        SDL_SetRenderDrawColor (game.renderer, 0x00, 0x00, 0x00, 0xFF);
-        SDL_RenderClear (game.renderer);
+        if (tick)
+        {
+            map_watch_poll (&game);
+            world_step (&game, game.dt);
 
-//        update (&game);
-        b2World_Step (game.world_id, game.dt, game.sub_step_count);
+            // fell far behind (debugger, window drag): don't try to catch up
+            next_tick += tick_counts;
+            if (frame_start > next_tick + 4 * tick_counts)
+            {
+                next_tick = frame_start + tick_counts;
+            }
+        }
 
-        render (&game);
-        b2World_Draw (game.world_id, &game.debug_draw);
+        // nothing new to show, never present the same frame twice
+        if (tick || redraw)
+        {
+            SDL_SetRenderDrawColor (game.renderer, 0x00, 0x00, 0x00, 0xFF);
+            SDL_RenderClear (game.renderer);
 
-        SDL_RenderPresent (game.renderer);
-        SDL_Delay (FRAME_TIME_MS);
+            render (&game);
+            if (game.physics->draw && game.debug_visible)
+            {
+                game.physics->draw (&game);
+            }
+
+            if (game.hud.visible && game.hud.atlas)
+            {
+                render_hud (&game);
+            }
+
+            SDL_RenderPresent (game.renderer);
+
+            u64 now = SDL_GetPerformanceCounter ();
+
+            if (game.input_time)
+            {
+                hud_sample (&game.hud.input, (float) ((now - game.input_time) * ms_per_count), &game.scratch);
+                hud_refresh (&game.hud.input, &game.scratch);
+                game.input_time = 0;
+            }
+
+            if (tick)
+            {
+                hud_sample (&game.hud.frame, (float) ((now - last_present) * ms_per_count), &game.scratch);
+                hud_sample (&game.hud.work, (float) ((now - frame_start) * ms_per_count), &game.scratch);
+                hud_rates (&game.hud, now, frequency, game.tick, game.flips);
+                last_present = now;
+            }
+        }
+
+        redraw = wait_input (&game, next_tick);
+
+        // the whole pass, redraw-only ones and the wait included
+        game.loop_allocs = alloc_stats.allocs - allocs;
+        if (game.tick >= ALLOC_WARMUP_TICKS)
+        {
+            game.steady_allocs += game.loop_allocs;
+        }
     }
 
     cleanup (&game);
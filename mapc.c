@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "arena.h"
+#include "level.h"
+#include "mapgen.h"
+#include "map.h"
+
+/*
+ * Map compiler: turns a map into C tables the game loads by copying.
+ *
+ *   mapc -name <name> -o <out.h> [map file | -gen WxH [-seed n] [-balls n]]
+ *
+ * Without a map file or -gen it compiles the embedded map in map.h.
+ */
+
+#define MAPC_CHUNK_SHIFT 4 // CHUNK_SHIFT in main.c, which checks it
+#define MAPC_CHUNK_SIZE  (1 << MAPC_CHUNK_SHIFT)
+#define MAPC_PER_LINE    32
+
+/*
+ * Cover the walls of one chunk with rectangles: take the first uncovered
+ * wall, grow it right as far as it goes, then down while the whole span is
+ * wall. Returns the number written to out.
+ */
+static u32
+merge_walls (const u8 *tiles, int w, int h, int cx, int cy, u8 *covered, struct level_rect *out)
+{
+    int x0 = cx << MAPC_CHUNK_SHIFT;
+    int y0 = cy << MAPC_CHUNK_SHIFT;
+    int cw = MIN (MAPC_CHUNK_SIZE, w - x0);
+    int ch = MIN (MAPC_CHUNK_SIZE, h - y0);
+    u32 n = 0;
+
+#define WALL(__x, __y) (tiles[(size_t) (y0 + (__y)) * w + x0 + (__x)] == TILE_WALL && \
+                        !covered[(__y) * MAPC_CHUNK_SIZE + (__x)])
+
+    memset (covered, 0, MAPC_CHUNK_SIZE * MAPC_CHUNK_SIZE);
+
+    for (int y = 0; y < ch; y++)
+    {
+        for (int x = 0; x < cw; x++)
+        {
+            if (!WALL (x, y))
+            {
+                continue;
+            }
+
+            int rw = 1;
+            int rh = 1;
+
+            while (x + rw < cw && WALL (x + rw, y))
+            {
+                rw++;
+            }
+
+            for (bool grow = true; grow && y + rh < ch; rh += grow)
+            {
+                for (int i = 0; i < rw && grow; i++)
+                {
+                    grow = WALL (x + i, y + rh);
+                }
+            }
+
+            for (int j = 0; j < rh; j++)
+            {
+                memset (&covered[(y + j) * MAPC_CHUNK_SIZE + x], 1, rw);
+            }
+
+            out[n++] = (struct level_rect) { (u8) x, (u8) y, (u8) rw, (u8) rh };
+        }
+    }
+
+#undef WALL
+
+    return n;
+}
+
+static void
+write_bytes (FILE *f, const u8 *bytes, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        fprintf (f, "%s%u,", i % MAPC_PER_LINE ? "" : "\n    ", bytes[i]);
+    }
+}
+
+static bool
+compile (const struct level *level, const char *name, const char *source, FILE *f, struct arena *arena)
+{
+    size_t n = (size_t) level->w * level->h;
+    int chunks_w = (level->w + MAPC_CHUNK_SIZE - 1) >> MAPC_CHUNK_SHIFT;
+    int chunks_h = (level->h + MAPC_CHUNK_SIZE - 1) >> MAPC_CHUNK_SHIFT;
+    u8 *tiles = ARENA_PUSH_ARRAY (arena, u8, n);
+    u32 *chunk_rects = ARENA_PUSH_ARRAY (arena, u32, chunks_w * chunks_h + 1);
+    struct level_rect *rects = ARENA_PUSH_ARRAY (arena, struct level_rect, n); // never more than one per wall
+    u8 covered[MAPC_CHUNK_SIZE * MAPC_CHUNK_SIZE];
+    u32 territory[3] = {0};
+    u32 n_spawns = 0;
+    u32 n_rects = 0;
+    u32 n_walls = 0;
+
+    if (!tiles || !chunk_rects || !rects)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        tiles[i] = level_tile (level->cells[i]);
+        n_spawns += TILE_TYPE (level->cells[i]) == TILE_PLAYER;
+        n_walls += tiles[i] == TILE_WALL;
+
+        if (TILE_TYPE (tiles[i]) == TILE_BLOCK)
+        {
+            territory[TILE_TEAM (tiles[i])]++;
+        }
+    }
+
+    for (int i = 0; i < chunks_w * chunks_h; i++)
+    {
+        chunk_rects[i] = n_rects;
+        n_rects += merge_walls (tiles, level->w, level->h, i % chunks_w, i / chunks_w, covered, &rects[n_rects]);
+    }
+    chunk_rects[chunks_w * chunks_h] = n_rects;
+
+    fprintf (f, "/* Generated by mapc from %s, don't edit. */\n\n", source);
+    fprintf (f, "#include \"level.h\"\n\n");
+
+    fprintf (f, "static const u8 level_%s_tiles[%zu] = {", name, n);
+    write_bytes (f, tiles, n);
+    fprintf (f, "\n};\n\n");
+
+    // C has no empty arrays, so these always get at least one entry
+    fprintf (f, "static const struct level_spawn level_%s_spawns[%u] = {", name, MAX (n_spawns, 1));
+    for (size_t i = 0, j = 0; i < n; i++)
+    {
+        if (TILE_TYPE (level->cells[i]) == TILE_PLAYER)
+        {
+            fprintf (f, "%s{ %d, %d, %d },", j++ % 8 ? " " : "\n    ",
+                     (int) (i % level->w), (int) (i / level->w), TILE_TEAM (level->cells[i]));
+        }
+    }
+    fprintf (f, "%s\n};\n\n", n_spawns ? "" : "\n    { 0 },");
+
+    fprintf (f, "static const u32 level_%s_chunk_rects[%d] = {", name, chunks_w * chunks_h + 1);
+    for (int i = 0; i <= chunks_w * chunks_h; i++)
+    {
+        fprintf (f, "%s%u,", i % 16 ? " " : "\n    ", chunk_rects[i]);
+    }
+    fprintf (f, "\n};\n\n");
+
+    fprintf (f, "static const struct level_rect level_%s_rects[%u] = {", name, MAX (n_rects, 1));
+    for (u32 i = 0; i < n_rects; i++)
+    {
+        fprintf (f, "%s{ %u, %u, %u, %u },", i % 8 ? " " : "\n    ", rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+    }
+    fprintf (f, "%s\n};\n\n", n_rects ? "" : "\n    { 0 },");
+
+    fprintf (f, "static const struct level_table level_%s = {\n", name);
+    fprintf (f, "    .name = \"%s\",\n", name);
+    fprintf (f, "    .w = %d,\n    .h = %d,\n", level->w, level->h);
+    fprintf (f, "    .tiles = level_%s_tiles,\n", name);
+    fprintf (f, "    .territory = { %u, %u, %u },\n", territory[0], territory[1], territory[2]);
+    fprintf (f, "    .n_spawns = %u,\n", n_spawns);
+    fprintf (f, "    .spawns = level_%s_spawns,\n", name);
+    fprintf (f, "    .chunk_shift = %d,\n", MAPC_CHUNK_SHIFT);
+    fprintf (f, "    .chunk_rects = level_%s_chunk_rects,\n", name);
+    fprintf (f, "    .rects = level_%s_rects,\n", name);
+    fprintf (f, "};\n");
+
+    printf ("%s: %dx%d, %u balls, %u walls in %u rects\n", name, level->w, level->h, n_spawns, n_walls, n_rects);
+
+    return !ferror (f);
+}
+
+int
+main (int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *out_path = NULL;
+    const char *map_path = NULL;
+    struct mapgen_params gen = mapgen_defaults (0, 0, 117);
+    struct arena arena = {0};
+    struct level level;
+    char source[64] = "map.h";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp (argv[i], "-name") == 0 && i + 1 < argc)
+        {
+            name = argv[++i];
+        }
+        else if (strcmp (argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (strcmp (argv[i], "-gen") == 0 && i + 1 < argc)
+        {
+            if (sscanf (argv[++i], "%dx%d", &gen.w, &gen.h) != 2)
+            {
+                gen.w = gen.h = 0;
+            }
+        }
+        else if (strcmp (argv[i], "-seed") == 0 && i + 1 < argc)
+        {
+            gen.seed = strtoull (argv[++i], NULL, 10);
+        }
+        else if (strcmp (argv[i], "-balls") == 0 && i + 1 < argc)
+        {
+            gen.n_balls = atoi (argv[++i]);
+        }
+        else
+        {
+            map_path = argv[i];
+        }
+    }
+
+    if (!name || !out_path)
+    {
+        fprintf (stderr, "usage: %s -name <name> -o <out.h> [map file | -gen WxH [-seed n] [-balls n]]\n", argv[0]);
+        return 1;
+    }
+
+    if (map_path)
+    {
+        FILE *f = fopen (map_path, "rb");
+        long len = 0;
+
+        if (f)
+        {
+            fseek (f, 0, SEEK_END);
+            len = ftell (f);
+            fseek (f, 0, SEEK_SET);
+        }
+
+        if (len <= 0)
+        {
+            fprintf (stderr, "can't read %s\n", map_path);
+            return 1;
+        }
+
+        arena_init (&arena, 8 * (size_t) len + KILOBYTES (4));
+
+        char *text = ARENA_PUSH_ARRAY (&arena, char, len);
+        bool ok = fread (text, 1, len, f) == (size_t) len && level_parse (&level, text, len, &arena);
+
+        fclose (f);
+
+        if (!ok)
+        {
+            fprintf (stderr, "can't parse %s\n", map_path);
+            return 1;
+        }
+
+        snprintf (source, sizeof (source), "%s", map_path);
+    }
+    else if (gen.w > 0)
+    {
+        arena_init (&arena, 8 * (size_t) gen.w * gen.h + KILOBYTES (4));
+
+        if (!mapgen (&level, &gen, &arena))
+        {
+            fprintf (stderr, "can't generate a %dx%d map\n", gen.w, gen.h);
+            return 1;
+        }
+
+        snprintf (source, sizeof (source), "-gen %dx%d -seed %llu", gen.w, gen.h, gen.seed);
+    }
+    else
+    {
+        arena_init (&arena, 8 * sizeof (map) + KILOBYTES (4));
+        level_from_u32 (&level, &map[0][0], LEN (map[0]), LEN (map), &arena);
+    }
+
+    FILE *f = fopen (out_path, "w");
+
+    if (!f)
+    {
+        fprintf (stderr, "can't write %s\n", out_path);
+        return 1;
+    }
+
+    bool ok = compile (&level, name, source, f, &arena);
+
+    fclose (f);
+    arena_free (&arena);
+
+    if (!ok)
+    {
+        fprintf (stderr, "failed to write %s\n", out_path);
+        remove (out_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,332 @@
+#ifndef _MAPGEN_
+#define _MAPGEN_
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "util.h"
+#include "arena.h"
+#include "level.h"
+
+/*
+ * Procedural maps in the level.h encoding, mirror-symmetric between the
+ * teams: the left half is LIGHT blocks, the right half is the same layout
+ * with DARK blocks, and every ball has a twin of the other team in the
+ * mirrored cell. Odd widths get a centre column alternating between teams.
+ *
+ * Every cell is a pure function of the seed and its position, so the result
+ * doesn't depend on how many threads built it.
+ */
+
+#define MAPGEN_MAX_THREADS 64
+#define MAPGEN_MIN_ROWS    64 // per thread
+
+enum mapgen_symmetry
+{
+    MAPGEN_MIRROR,  // (x, y) <-> (w - 1 - x, y)
+    MAPGEN_ROTATE   // (x, y) <-> (w - 1 - x, h - 1 - y)
+};
+
+enum mapgen_spawn
+{
+    MAPGEN_SPAWN_RANDOM,
+    MAPGEN_SPAWN_GRID    // evenly spread over the half
+};
+
+struct mapgen_params
+{
+    int w, h;
+    u64 seed;
+    enum mapgen_symmetry symmetry;
+    float wall_density; // fraction of the interior that is wall, 0..1
+    int wall_size;      // obstacles are wall_size squares
+    int n_balls;        // per team
+    enum mapgen_spawn spawn;
+};
+
+static struct mapgen_params
+mapgen_defaults (int w, int h, u64 seed)
+{
+    return (struct mapgen_params) {
+        .w = w,
+        .h = h,
+        .seed = seed,
+        .symmetry = MAPGEN_MIRROR,
+        .wall_density = 0.05f,
+        .wall_size = 2,
+        .n_balls = 1,
+        .spawn = MAPGEN_SPAWN_RANDOM,
+    };
+}
+
+static u64
+mapgen_mix (u64 x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static u64
+mapgen_next (u64 *state)
+{
+    *state += 0x9E3779B97F4A7C15ull;
+    return mapgen_mix (*state);
+}
+
+static u8
+mapgen_other_team (u8 cell)
+{
+    return TILE_TEAM (cell) ? cell ^ (TILE_LIGHT | TILE_DARK) : cell;
+}
+
+/* The mirror of (x, y) in the other half. */
+static u32
+mapgen_twin (const struct mapgen_params *params, int x, int y)
+{
+    int ty = params->symmetry == MAPGEN_ROTATE ? params->h - 1 - y : y;
+
+    return ty * params->w + (params->w - 1 - x);
+}
+
+struct mapgen_job
+{
+    const struct mapgen_params *params;
+    u8 *cells;
+    int y0, y1;
+    u32 threshold; // wall when a cell's hash is below this, out of 1 << 24
+};
+
+/*
+ * Fill [x0, x1) of a row with blocks, then the obstacle-sized runs whose
+ * hash makes them wall.
+ */
+static void
+mapgen_runs (u8 *row, int x0, int x1, int size, u64 row_key, u32 threshold, u8 block)
+{
+    memset (&row[x0], block, x1 - x0);
+
+    for (int run = x0 / size; run * size < x1; run++)
+    {
+        if ((mapgen_mix (row_key ^ (u32) run) >> 40) < threshold)
+        {
+            int a = MAX (run * size, x0);
+            int b = MIN ((run + 1) * size, x1);
+
+            memset (&row[a], TILE_WALL, b - a);
+        }
+    }
+}
+
+/*
+ * Write the first n cells of row reversed, with the teams swapped, ending
+ * at end. Eight at a time: only blocks and balls have team bits, and a
+ * byte with either set gets both flipped.
+ */
+static void
+mapgen_mirror (u8 *end, const u8 *row, int n)
+{
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        u64 v;
+        memcpy (&v, &row[x], sizeof (v));
+
+        u64 teams = v & 0x3030303030303030ull;
+        v ^= (((teams >> 4) | (teams >> 5)) & 0x0101010101010101ull) * (TILE_LIGHT | TILE_DARK);
+        v = _byteswap_uint64 (v);
+
+        memcpy (end - x - 7, &v, sizeof (v));
+    }
+
+    for (; x < n; x++)
+    {
+        end[-x] = mapgen_other_team (row[x]);
+    }
+}
+
+/*
+ * Fill rows [y0, y1) and their twins. MAPGEN_MIRROR generates the left half
+ * of every row. MAPGEN_ROTATE generates the top rows whole (the middle one
+ * by halves), and their twins fill the bottom.
+ */
+static DWORD WINAPI
+mapgen_rows (void *param)
+{
+    struct mapgen_job *job = param;
+    const struct mapgen_params *p = job->params;
+    int half = p->w / 2;
+    int size = MAX (p->wall_size, 1);
+    u64 key = mapgen_mix (p->seed);
+
+    for (int y = job->y0; y < job->y1; y++)
+    {
+        u8 *row = &job->cells[(size_t) y * p->w];
+        bool whole = p->symmetry == MAPGEN_ROTATE && 2 * y + 1 != p->h;
+
+        if (y == 0 || y == p->h - 1)
+        {
+            memset (row, TILE_WALL, p->w);
+        }
+        else if (y % size && y - 1 >= job->y0 && y - 1 != 0)
+        {
+            // same obstacle row as the one above, whose hashes would all repeat
+            memcpy (row, row - p->w, whole ? p->w : half);
+        }
+        else
+        {
+            u64 row_key = key ^ (u64) (y / size) << 32;
+
+            mapgen_runs (row, 0, half, size, row_key, job->threshold, TILE_BLOCK | TILE_LIGHT);
+            if (whole)
+            {
+                mapgen_runs (row, half + (p->w & 1), p->w, size, row_key, job->threshold, TILE_BLOCK | TILE_DARK);
+            }
+
+            row[0] = TILE_WALL;
+            row[p->w - 1] = TILE_WALL;
+        }
+
+        if ((p->w & 1) && y != 0 && y != p->h - 1)
+        {
+            row[half] = TILE_BLOCK | (y & 1 ? TILE_DARK : TILE_LIGHT);
+        }
+
+        // the centre column is its own twin unless the row is whole
+        size_t twin = (size_t) (whole ? p->h - 1 - y : y) * p->w + p->w - 1;
+        mapgen_mirror (&job->cells[twin], row, whole ? p->w : half);
+    }
+
+    return 0;
+}
+
+/*
+ * Place a ball of the DARK team in the LIGHT half and its LIGHT twin.
+ */
+static bool
+mapgen_place (const struct mapgen_params *p, u8 *cells, int x, int y)
+{
+    u8 *cell = &cells[(size_t) y * p->w + x];
+
+    if (TILE_TYPE (*cell) != TILE_BLOCK)
+    {
+        return false;
+    }
+
+    *cell = TILE_PLAYER | TILE_DARK;
+    cells[mapgen_twin (p, x, y)] = TILE_PLAYER | TILE_LIGHT;
+
+    return true;
+}
+
+static void
+mapgen_spawn (const struct mapgen_params *p, u8 *cells)
+{
+    int half = p->w / 2;
+    int inner_w = half - 1; // without the border
+    int inner_h = p->h - 2;
+    u64 rng = p->seed ^ 0x5350415741ull;
+
+    if (inner_w <= 0 || inner_h <= 0)
+    {
+        return;
+    }
+
+    if (p->spawn == MAPGEN_SPAWN_GRID)
+    {
+        int cols = MAX (1, (int) ceilf (sqrtf ((float) p->n_balls * inner_w / inner_h)));
+        int rows = (p->n_balls + cols - 1) / cols;
+
+        for (int i = 0; i < p->n_balls; i++)
+        {
+            int x = 1 + (int) (((i % cols) + 0.5f) * inner_w / cols);
+            int y = 1 + (int) (((i / cols) + 0.5f) * inner_h / rows);
+
+            // step along the row past walls
+            for (int dx = 0; dx < inner_w; dx++)
+            {
+                if (mapgen_place (p, cells, 1 + (x - 1 + dx) % inner_w, y))
+                {
+                    break;
+                }
+            }
+        }
+    }
+    else
+    {
+        int placed = 0;
+
+        for (int attempt = 0; placed < p->n_balls && attempt < 16 * p->n_balls; attempt++)
+        {
+            int x = 1 + (int) (mapgen_next (&rng) % inner_w);
+            int y = 1 + (int) (mapgen_next (&rng) % inner_h);
+
+            placed += mapgen_place (p, cells, x, y);
+        }
+    }
+}
+
+static bool
+mapgen (struct level *level, const struct mapgen_params *params, struct arena *arena)
+{
+    struct mapgen_job jobs[MAPGEN_MAX_THREADS];
+    HANDLE threads[MAPGEN_MAX_THREADS];
+    SYSTEM_INFO info;
+
+    if (params->w < 3 || params->h < 3)
+    {
+        return false;
+    }
+
+    level->w = params->w;
+    level->h = params->h;
+    level->cells = ARENA_PUSH_ARRAY (arena, u8, (size_t) params->w * params->h);
+
+    if (!level->cells)
+    {
+        return false;
+    }
+
+    GetSystemInfo (&info);
+
+    int rows = params->symmetry == MAPGEN_ROTATE ? (params->h + 1) / 2 : params->h;
+    int n_jobs = CLAMP (rows / MAPGEN_MIN_ROWS, 1, MIN ((int) info.dwNumberOfProcessors, MAPGEN_MAX_THREADS));
+    u32 threshold = (u32) (CLAMP (params->wall_density, 0.0f, 1.0f) * (1 << 24));
+
+    for (int i = 0; i < n_jobs; i++)
+    {
+        jobs[i] = (struct mapgen_job) {
+            .params = params,
+            .cells = level->cells,
+            .y0 = (int) ((u64) rows * i / n_jobs),
+            .y1 = (int) ((u64) rows * (i + 1) / n_jobs),
+            .threshold = threshold,
+        };
+    }
+
+    // the calling thread takes the first band
+    for (int i = 1; i < n_jobs; i++)
+    {
+        threads[i] = CreateThread (NULL, 0, mapgen_rows, &jobs[i], 0, NULL);
+        ASSERT (threads[i]);
+    }
+
+    mapgen_rows (&jobs[0]);
+
+    for (int i = 1; i < n_jobs; i++)
+    {
+        WaitForSingleObject (threads[i], INFINITE);
+        CloseHandle (threads[i]);
+    }
+
+    mapgen_spawn (params, level->cells);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "metrics.h"
+
+/*
+ * Reader for the metrics block of a running game:
+ *
+ *   auto-pong-metrics <pid> [-once] [-interval ms]
+ *
+ * Prints one line per interval, or a single one with -once.
+ */
+
+static void
+print_metrics (struct metrics_block *m)
+{
+    printf ("tick %llu  tps %.1f  step %.3f ms  flips %llu  light %u blocks %u balls  dark %u blocks %u balls\n",
+            m->tick, m->tps, m->step_ms, m->flips,
+            m->territory[1], m->balls[1], m->territory[2], m->balls[2]);
+
+    printf ("  step us:");
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++)
+    {
+        if (m->step_hist[i])
+        {
+            printf (" <%u:%llu", 1u << i, m->step_hist[i]);
+        }
+    }
+    printf ("\n");
+}
+
+int
+main (int argc, char **argv)
+{
+    DWORD pid = 0;
+    bool once = false;
+    int interval = 1000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp (argv[i], "-once") == 0)
+        {
+            once = true;
+        }
+        else if (strcmp (argv[i], "-interval") == 0 && i + 1 < argc)
+        {
+            interval = MAX (atoi (argv[++i]), 1);
+        }
+        else
+        {
+            pid = strtoul (argv[i], NULL, 10);
+        }
+    }
+
+    if (pid == 0)
+    {
+        fprintf (stderr, "usage: %s <pid> [-once] [-interval ms]\n", argv[0]);
+        return 1;
+    }
+
+    char name[64];
+    snprintf (name, sizeof (name), METRICS_NAME, pid);
+
+    HANDLE mapping = OpenFileMappingA (FILE_MAP_READ, FALSE, name);
+    const struct metrics_block *block = mapping
+                                      ? MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, sizeof (struct metrics_block))
+                                      : NULL;
+
+    if (!block)
+    {
+        fprintf (stderr, "no metrics for pid %lu\n", pid);
+        return 1;
+    }
+
+    if (!metrics_compatible (block))
+    {
+        fprintf (stderr, "unknown metrics layout (version %u, %u bytes)\n", block->version, block->size);
+        UnmapViewOfFile (block);
+        CloseHandle (mapping);
+        return 1;
+    }
+
+    u64 last_tick = 0;
+    int stalled = 0;
+
+    do
+    {
+        struct metrics_block m;
+        bool ok = metrics_read (block, &m);
+
+        // the writer may just have been preempted mid-update, give it a moment
+        for (int retry = 0; !ok && retry < 10; retry++)
+        {
+            Sleep (1);
+            ok = metrics_read (block, &m);
+        }
+
+        if (!ok)
+        {
+            fprintf (stderr, "no consistent snapshot, the game may have stopped mid-update\n");
+            break;
+        }
+
+        print_metrics (&m);
+        fflush (stdout);
+
+        // the mapping outlives the game while we hold it, so watch for ticks stopping instead
+        stalled = m.tick == last_tick ? stalled + 1 : 0;
+        last_tick = m.tick;
+
+        if (!once)
+        {
+            Sleep (interval);
+        }
+    } while (!once && stalled * interval < 5000);
+
+    UnmapViewOfFile (block);
+    CloseHandle (mapping);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+#ifndef _METRICS_
+#define _METRICS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "util.h"
+
+/*
+ * Metrics block shared with external readers through a named file mapping,
+ * METRICS_NAME with the game's pid. The game writes it every tick with plain
+ * stores under a sequence lock: seq is odd while an update is in progress,
+ * and a reader retries until it sees the same even seq before and after its
+ * copy. Publishing never blocks and makes no system calls.
+ *
+ * Readers must check magic, version and size before trusting the rest. Any
+ * layout change bumps METRICS_VERSION; fields are only ever appended.
+ */
+
+#define METRICS_NAME         "Local\\auto-pong-metrics-%lu"
+#define METRICS_MAGIC        0x4D475041 // "APGM"
+#define METRICS_VERSION      1
+#define METRICS_HIST_BUCKETS 24 // bucket 0 is under 1 us, bucket i is [2^(i-1), 2^i) us
+#define METRICS_READ_RETRIES 100000
+
+struct metrics_block
+{
+    u32 magic;
+    u32 version;
+    u32 size;
+    u32 hist_buckets;
+    volatile u32 seq;
+    u32 reserved;
+
+    u64 tick;
+    u64 flips;
+    float tps;      // over the last whole second
+    float step_ms;  // last tick
+    u64 step_hist[METRICS_HIST_BUCKETS];
+    u32 territory[3]; // blocks per team, index by E_TEAM_*
+    u32 balls[3];     // balls per team
+};
+
+struct metrics
+{
+    HANDLE mapping;
+    struct metrics_block *block;
+
+    u64 second_start;
+    u64 second_tick;
+};
+
+static bool
+metrics_init (struct metrics *metrics)
+{
+    char name[64];
+
+    snprintf (name, sizeof (name), METRICS_NAME, GetCurrentProcessId ());
+
+    metrics->mapping = CreateFileMappingA (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                           0, sizeof (struct metrics_block), name);
+    metrics->block = metrics->mapping
+                   ? MapViewOfFile (metrics->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof (struct metrics_block))
+                   : NULL;
+
+    if (!metrics->block)
+    {
+        if (metrics->mapping)
+        {
+            CloseHandle (metrics->mapping);
+        }
+        *metrics = (struct metrics) {0};
+        return false;
+    }
+
+    memset (metrics->block, 0, sizeof (*metrics->block));
+    metrics->block->size = sizeof (struct metrics_block);
+    metrics->block->hist_buckets = METRICS_HIST_BUCKETS;
+    metrics->block->version = METRICS_VERSION;
+    _WriteBarrier ();
+    metrics->block->magic = METRICS_MAGIC;
+
+    return true;
+}
+
+static void
+metrics_shutdown (struct metrics *metrics)
+{
+    if (metrics->block)
+    {
+        UnmapViewOfFile (metrics->block);
+        CloseHandle (metrics->mapping);
+    }
+
+    *metrics = (struct metrics) {0};
+}
+
+static int
+metrics_bucket (float ms)
+{
+    u32 us = (u32) (ms * 1000.0f);
+    int bucket = 0;
+
+    while (us && bucket < METRICS_HIST_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*
+ * Writer side: everything between begin and end is seen by readers as one
+ * update. x64 doesn't reorder stores with other stores, the barriers only
+ * stop the compiler doing it.
+ */
+static void
+metrics_begin (struct metrics_block *block)
+{
+    block->seq++;
+    _WriteBarrier ();
+}
+
+static void
+metrics_end (struct metrics_block *block)
+{
+    _WriteBarrier ();
+    block->seq++;
+}
+
+/*
+ * Reader side.
+ */
+static bool
+metrics_compatible (const struct metrics_block *block)
+{
+    return block->magic == METRICS_MAGIC && block->version == METRICS_VERSION &&
+           block->size == sizeof (struct metrics_block);
+}
+
+/*
+ * Returns false if no consistent copy was seen in METRICS_READ_RETRIES
+ * tries, e.g. the writer died in the middle of an update.
+ */
+static bool
+metrics_read (const struct metrics_block *block, struct metrics_block *out)
+{
+    for (int retry = 0; retry < METRICS_READ_RETRIES; retry++)
+    {
+        u32 seq = block->seq;
+        _ReadBarrier ();
+
+        if (seq & 1)
+        {
+            YieldProcessor ();
+            continue;
+        }
+
+        memcpy (out, (const void *) block, sizeof (*out));
+        _ReadBarrier ();
+
+        if (block->seq == seq)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif
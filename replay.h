@@ -0,0 +1,623 @@
+#ifndef _REPLAY_
+#define _REPLAY_
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "util.h"
+#include "arena.h"
+#include "level.h"
+#include "log.h"
+
+/*
+ * Replay files
+ *
+ * header   struct replay_header, then the map cells as first loaded
+ * frames   one per tick: u8 kind, u32 payload size, payload
+ * index    struct replay_key for every keyframe
+ * trailer  struct replay_trailer
+ *
+ * Ball positions (centres) and velocities are quantised to 1/REPLAY_SCALE of
+ * a tile. A keyframe holds every ball slot and the run-length encoded tiles.
+ * A delta holds, for each live ball, the change since the previous tick and
+ * the cells that flipped, all as varints. Any change to the set of balls, or
+ * to tiles other than by flips, gets a keyframe instead.
+ *
+ * Seeking decodes the keyframe at or before the tick and at most
+ * key_interval - 1 deltas after it.
+ */
+
+#define REPLAY_MAGIC        0x50525041 // "APRP"
+#define REPLAY_INDEX_MAGIC  0x49525041 // "APRI"
+#define REPLAY_VERSION      1
+#define REPLAY_SCALE        256.0f
+#define REPLAY_KEY_INTERVAL 120        // default, in ticks
+#define REPLAY_MAX_KEYS     65536      // past this, keyframes are only written when forced
+
+#define REPLAY_FRAME_KEY    1
+#define REPLAY_FRAME_DELTA  2
+#define REPLAY_FRAME_HEADER 5          // kind + size
+
+struct replay_header
+{
+    u32 magic;
+    u32 version;
+    u32 w, h;
+    u64 seed;
+    u32 max_balls; // ball slots, replay_state.balls is this long
+    u32 key_interval;
+    float dt;
+    u32 reserved;
+};
+
+struct replay_key
+{
+    u64 tick;
+    u64 offset;
+};
+
+struct replay_trailer
+{
+    u64 index_offset;
+    u64 n_ticks;
+    u32 n_keys;
+    u32 magic;
+};
+
+struct replay_ball
+{
+    u8 team;  // E_TEAM_*, 0 for an empty slot
+    int q[4]; // x, y, vx, vy
+};
+
+struct replay_state
+{
+    u64 tick;
+    int w, h;
+    u8 *tiles;
+    u32 n_balls; // slots in use
+    struct replay_ball *balls;
+};
+
+static u8 *
+replay_put_varint (u8 *p, u32 value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (u8) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (u8) value;
+
+    return p;
+}
+
+static u8 *
+replay_put_signed (u8 *p, int value)
+{
+    return replay_put_varint (p, ((u32) value << 1) ^ (u32) (value >> 31));
+}
+
+/*
+ * Bounds-checked reads; a truncated or corrupt frame sets error rather than
+ * reading past the mapping.
+ */
+struct replay_reader
+{
+    const u8 *p;
+    const u8 *end;
+    bool error;
+};
+
+static u32
+replay_get_varint (struct replay_reader *r)
+{
+    u32 value = 0;
+
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (r->p >= r->end)
+        {
+            r->error = true;
+            return 0;
+        }
+
+        u8 byte = *r->p++;
+        value |= (u32) (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+
+    r->error = true;
+    return 0;
+}
+
+static int
+replay_get_signed (struct replay_reader *r)
+{
+    u32 value = replay_get_varint (r);
+
+    return (int) (value >> 1) ^ -(int) (value & 1);
+}
+
+static int
+replay_quantise (float value)
+{
+    return (int) lroundf (value * REPLAY_SCALE);
+}
+
+static float
+replay_dequantise (int value)
+{
+    return value / REPLAY_SCALE;
+}
+
+/*
+ * Recording
+ */
+struct replay_recorder
+{
+    FILE *file;
+    struct arena arena;
+    struct replay_header header;
+
+    u64 offset;
+    u64 tick;
+    u32 since_key;
+    bool force_key; // set by the caller when tiles changed other than by flips
+
+    struct replay_key *keys;
+    u32 n_keys;
+
+    struct replay_ball *prev;
+    u32 n_prev;
+
+    struct replay_ball *balls; // filled by the caller each tick, max_balls long
+
+    u8 *buffer; // one encoded frame
+    size_t buffer_size;
+};
+
+static void
+replay_write (struct replay_recorder *rec, const void *data, size_t size)
+{
+    fwrite (data, 1, size, rec->file);
+    rec->offset += size;
+}
+
+static bool
+replay_record_begin (struct replay_recorder *rec, const char *path, const struct level *map,
+                     u64 seed, u32 max_balls, u32 max_flips, u32 key_interval, float dt)
+{
+    *rec = (struct replay_recorder) {0};
+    rec->file = fopen (path, "wb");
+
+    if (!rec->file)
+    {
+        LOG_ERROR ("Failed to open replay for writing");
+        return false;
+    }
+
+    size_t n_tiles = (size_t) map->w * map->h;
+
+    // worst case is a keyframe (or a delta with every flip logged), varints are at most 5 bytes
+    rec->buffer_size = 16 + max_balls * (1 + 4 * 5) + MAX (2 * n_tiles, 5 * (size_t) max_flips);
+
+    arena_init (&rec->arena, rec->buffer_size + sizeof (struct replay_key) * REPLAY_MAX_KEYS +
+                             2 * sizeof (struct replay_ball) * max_balls + 4 * ARENA_ALIGN);
+
+    rec->buffer = ARENA_PUSH_ARRAY (&rec->arena, u8, rec->buffer_size);
+    rec->keys = ARENA_PUSH_ARRAY (&rec->arena, struct replay_key, REPLAY_MAX_KEYS);
+    rec->prev = ARENA_PUSH_ARRAY (&rec->arena, struct replay_ball, max_balls);
+    rec->balls = ARENA_PUSH_ARRAY (&rec->arena, struct replay_ball, max_balls);
+
+    rec->header = (struct replay_header) {
+        .magic = REPLAY_MAGIC,
+        .version = REPLAY_VERSION,
+        .w = map->w,
+        .h = map->h,
+        .seed = seed,
+        .max_balls = max_balls,
+        .key_interval = MAX (key_interval, 1),
+        .dt = dt,
+    };
+
+    // the stdio buffer batches the per-tick writes
+    setvbuf (rec->file, NULL, _IOFBF, KILOBYTES (64));
+
+    replay_write (rec, &rec->header, sizeof (rec->header));
+    replay_write (rec, map->cells, n_tiles);
+    rec->force_key = true;
+
+    return true;
+}
+
+static void
+replay_write_frame (struct replay_recorder *rec, u8 kind, u8 *end)
+{
+    u32 size = (u32) (end - rec->buffer);
+
+    ASSERT (size <= rec->buffer_size);
+
+    replay_write (rec, &kind, 1);
+    replay_write (rec, &size, sizeof (size));
+    replay_write (rec, rec->buffer, size);
+}
+
+/*
+ * Record one tick. balls is indexed by slot; flipped is the flip log of the
+ * tick, n_flipped may exceed the number stored (see sim_grid).
+ */
+static void
+replay_record_frame (struct replay_recorder *rec, const u8 *tiles,
+                     const struct replay_ball *balls, u32 n_balls,
+                     const u32 *flipped, u32 n_flipped, u32 max_flipped)
+{
+    // a delta can't describe these
+    bool key = rec->force_key || n_balls != rec->n_prev || n_flipped > max_flipped;
+
+    for (u32 i = 0; i < n_balls && !key; i++)
+    {
+        key = balls[i].team != rec->prev[i].team;
+    }
+
+    if (rec->since_key >= rec->header.key_interval && rec->n_keys < REPLAY_MAX_KEYS)
+    {
+        key = true;
+    }
+
+    u8 *p = rec->buffer;
+
+    if (key)
+    {
+        if (rec->n_keys < REPLAY_MAX_KEYS)
+        {
+            rec->keys[rec->n_keys++] = (struct replay_key) { rec->tick, rec->offset };
+        }
+
+        p = replay_put_varint (p, n_balls);
+        for (u32 i = 0; i < n_balls; i++)
+        {
+            *p++ = balls[i].team;
+            if (balls[i].team)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    p = replay_put_signed (p, balls[i].q[j]);
+                }
+            }
+        }
+
+        u32 n_tiles = rec->header.w * rec->header.h;
+        for (u32 i = 0; i < n_tiles;)
+        {
+            u32 run = 1;
+            while (i + run < n_tiles && tiles[i + run] == tiles[i])
+            {
+                run++;
+            }
+
+            *p++ = tiles[i];
+            p = replay_put_varint (p, run);
+            i += run;
+        }
+
+        replay_write_frame (rec, REPLAY_FRAME_KEY, p);
+        rec->since_key = 0;
+        rec->force_key = false;
+    }
+    else
+    {
+        for (u32 i = 0; i < n_balls; i++)
+        {
+            if (balls[i].team)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    p = replay_put_signed (p, balls[i].q[j] - rec->prev[i].q[j]);
+                }
+            }
+        }
+
+        // a flip toggles the team bits, so only the cell is needed
+        u32 last = 0;
+        p = replay_put_varint (p, n_flipped);
+        for (u32 i = 0; i < n_flipped; i++)
+        {
+            p = replay_put_signed (p, (int) (flipped[i] - last));
+            last = flipped[i];
+        }
+
+        replay_write_frame (rec, REPLAY_FRAME_DELTA, p);
+    }
+
+    memcpy (rec->prev, balls, sizeof (*balls) * n_balls);
+    rec->n_prev = n_balls;
+    rec->since_key++;
+    rec->tick++;
+}
+
+static void
+replay_record_end (struct replay_recorder *rec)
+{
+    if (!rec->file)
+    {
+        return;
+    }
+
+    struct replay_trailer trailer = {
+        .index_offset = rec->offset,
+        .n_ticks = rec->tick,
+        .n_keys = rec->n_keys,
+        .magic = REPLAY_INDEX_MAGIC,
+    };
+
+    replay_write (rec, rec->keys, sizeof (*rec->keys) * rec->n_keys);
+    replay_write (rec, &trailer, sizeof (trailer));
+    fclose (rec->file);
+
+    LOG_INFO ("Replay: %llu ticks, %u keyframes, %llu bytes", rec->tick, rec->n_keys, rec->offset);
+
+    arena_free (&rec->arena);
+    *rec = (struct replay_recorder) {0};
+}
+
+/*
+ * Playback from a read-only mapping of the file.
+ */
+struct replay_view
+{
+    HANDLE file;
+    HANDLE mapping;
+    const u8 *data;
+    u64 size;
+
+    const struct replay_header *header;
+    const u8 *cells; // map as first loaded
+    const struct replay_key *keys;
+    u32 n_keys;
+    u64 n_ticks;
+
+    struct arena arena;
+    struct replay_state state;
+    u64 next; // offset of the frame after state.tick
+    bool valid;
+};
+
+static void
+replay_close (struct replay_view *view)
+{
+    if (view->data)
+    {
+        UnmapViewOfFile (view->data);
+    }
+    if (view->mapping)
+    {
+        CloseHandle (view->mapping);
+    }
+    if (view->file && view->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle (view->file);
+    }
+
+    arena_free (&view->arena);
+    *view = (struct replay_view) {0};
+}
+
+static bool
+replay_open (struct replay_view *view, const char *path)
+{
+    LARGE_INTEGER size;
+
+    *view = (struct replay_view) {0};
+    view->file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (view->file == INVALID_HANDLE_VALUE || !GetFileSizeEx (view->file, &size) ||
+        size.QuadPart < (LONGLONG) (sizeof (struct replay_header) + sizeof (struct replay_trailer)))
+    {
+        LOG_ERROR ("Failed to open replay");
+        replay_close (view);
+        return false;
+    }
+
+    view->size = size.QuadPart;
+    view->mapping = CreateFileMappingA (view->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    view->data = view->mapping ? MapViewOfFile (view->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    if (!view->data)
+    {
+        LOG_ERROR ("Failed to map replay");
+        replay_close (view);
+        return false;
+    }
+
+    const struct replay_header *header = (const void *) view->data;
+    struct replay_trailer trailer;
+
+    memcpy (&trailer, view->data + view->size - sizeof (trailer), sizeof (trailer));
+
+    u64 n_tiles = (u64) header->w * header->h;
+    u64 frames = sizeof (*header) + n_tiles;
+
+    if (header->magic != REPLAY_MAGIC || header->version != REPLAY_VERSION ||
+        trailer.magic != REPLAY_INDEX_MAGIC || trailer.n_keys == 0 ||
+        trailer.index_offset < frames ||
+        trailer.index_offset + sizeof (struct replay_key) * trailer.n_keys + sizeof (trailer) != view->size)
+    {
+        LOG_ERROR ("Not a replay, or the recording didn't finish");
+        replay_close (view);
+        return false;
+    }
+
+    view->header = header;
+    view->cells = view->data + sizeof (*header);
+    view->keys = (const void *) (view->data + trailer.index_offset);
+    view->n_keys = trailer.n_keys;
+    view->n_ticks = trailer.n_ticks;
+
+    arena_init (&view->arena, n_tiles + sizeof (struct replay_ball) * header->max_balls + 2 * ARENA_ALIGN);
+    view->state.w = header->w;
+    view->state.h = header->h;
+    view->state.tiles = ARENA_PUSH_ARRAY (&view->arena, u8, n_tiles);
+    view->state.balls = ARENA_PUSH_ARRAY (&view->arena, struct replay_ball, header->max_balls);
+
+    return true;
+}
+
+/*
+ * Decode the frame at offset on top of the current state.
+ */
+static bool
+replay_decode (struct replay_view *view, u64 offset)
+{
+    struct replay_state *state = &view->state;
+    u32 size;
+
+    if (offset + REPLAY_FRAME_HEADER > view->size)
+    {
+        return false;
+    }
+
+    u8 kind = view->data[offset];
+    memcpy (&size, view->data + offset + 1, sizeof (size));
+
+    if (offset + REPLAY_FRAME_HEADER + size > view->size)
+    {
+        return false;
+    }
+
+    struct replay_reader r = {
+        .p = view->data + offset + REPLAY_FRAME_HEADER,
+        .end = view->data + offset + REPLAY_FRAME_HEADER + size,
+    };
+
+    if (kind == REPLAY_FRAME_KEY)
+    {
+        u32 n_balls = replay_get_varint (&r);
+
+        if (n_balls > view->header->max_balls)
+        {
+            return false;
+        }
+
+        state->n_balls = n_balls;
+        for (u32 i = 0; i < n_balls && !r.error; i++)
+        {
+            struct replay_ball *ball = &state->balls[i];
+
+            ball->team = r.p < r.end ? *r.p++ : 0;
+            for (int j = 0; j < 4; j++)
+            {
+                ball->q[j] = ball->team ? replay_get_signed (&r) : 0;
+            }
+        }
+
+        u32 n_tiles = state->w * state->h;
+        for (u32 i = 0; i < n_tiles && !r.error;)
+        {
+            u8 tile = r.p < r.end ? *r.p++ : 0;
+            u32 run = replay_get_varint (&r);
+
+            if (run == 0 || run > n_tiles - i)
+            {
+                return false;
+            }
+
+            memset (&state->tiles[i], tile, run);
+            i += run;
+        }
+    }
+    else if (kind == REPLAY_FRAME_DELTA && view->valid)
+    {
+        for (u32 i = 0; i < state->n_balls; i++)
+        {
+            struct replay_ball *ball = &state->balls[i];
+
+            if (ball->team)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    ball->q[j] += replay_get_signed (&r);
+                }
+            }
+        }
+
+        u32 n_tiles = state->w * state->h;
+        u32 n_flipped = replay_get_varint (&r);
+        u32 cell = 0;
+
+        for (u32 i = 0; i < n_flipped && !r.error; i++)
+        {
+            cell += replay_get_signed (&r);
+            if (cell >= n_tiles)
+            {
+                return false;
+            }
+            state->tiles[cell] ^= TILE_LIGHT | TILE_DARK;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    view->next = offset + REPLAY_FRAME_HEADER + size;
+
+    return !r.error;
+}
+
+/*
+ * Bring the state to tick: forward from the current state when no keyframe
+ * lies between, otherwise from the nearest keyframe at or before it.
+ */
+static bool
+replay_seek (struct replay_view *view, u64 tick)
+{
+    if (view->n_ticks == 0)
+    {
+        return false;
+    }
+
+    tick = MIN (tick, view->n_ticks - 1);
+
+    // last keyframe at or before tick
+    u32 lo = 0;
+    u32 hi = view->n_keys;
+    while (hi - lo > 1)
+    {
+        u32 mid = (lo + hi) / 2;
+        if (view->keys[mid].tick <= tick)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    const struct replay_key *key = &view->keys[lo];
+
+    if (!view->valid || view->state.tick > tick || view->state.tick < key->tick)
+    {
+        view->valid = replay_decode (view, key->offset);
+        view->state.tick = key->tick;
+    }
+
+    while (view->valid && view->state.tick < tick)
+    {
+        view->valid = replay_decode (view, view->next);
+        view->state.tick++;
+    }
+
+    return view->valid;
+}
+
+#endif
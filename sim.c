@@ -0,0 +1,769 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "sim.h"
+#include "arena.h"
+
+#define SIM_MAX_WORKERS     64
+#define SIM_ENV_GRAIN       16    // environments a worker takes at a time
+
+
+bool
+sim_tile_solid (u8 tile, int team, bool walls)
+{
+    return (walls && TILE_TYPE (tile) == TILE_WALL) ||
+           (TILE_TYPE (tile) == TILE_BLOCK && TILE_TEAM (tile) == team);
+}
+
+/*
+ * Occupancy planes: 0 is walls, 1 and 2 the blocks of that team.
+ */
+static u64 *
+sim_plane (struct sim_grid *grid, int plane)
+{
+    return grid->occupancy + (size_t) plane * SIM_STRIDE (grid->w) * grid->h;
+}
+
+size_t
+sim_occupancy_size (int w, int h)
+{
+    return 3 * sizeof (u64) * SIM_STRIDE (w) * h;
+}
+
+void
+sim_occupancy_update (struct sim_grid *grid, u32 cell)
+{
+    u8 tile = grid->tiles[cell];
+    size_t word = (size_t) (cell / grid->w) * SIM_STRIDE (grid->w) + (cell % grid->w) / 64;
+    u64 bit = 1ull << (cell % grid->w % 64);
+
+    for (int plane = 0; plane < 3; plane++)
+    {
+        bool set = plane == 0 ? TILE_TYPE (tile) == TILE_WALL
+                              : TILE_TYPE (tile) == TILE_BLOCK && TILE_TEAM (tile) == plane;
+        u64 *bits = &sim_plane (grid, plane)[word];
+
+        *bits = set ? *bits | bit : *bits & ~bit;
+    }
+}
+
+/*
+ * A bit for each of the 8 bytes of v equal to k, first byte lowest: flag
+ * the zero bytes of v ^ k without carries between them, then gather the
+ * flags into one byte with a multiply.
+ */
+static u64
+sim_bytes_equal (u64 v, u8 k)
+{
+    const u64 low7 = 0x7F7F7F7F7F7F7F7Full;
+    u64 x = v ^ (0x0101010101010101ull * k);
+    u64 zero = ~(((x & low7) + low7) | x | low7);
+
+    return ((zero >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+void
+sim_occupancy_build (struct sim_grid *grid)
+{
+    int stride = SIM_STRIDE (grid->w);
+    u64 *planes[3] = { sim_plane (grid, 0), sim_plane (grid, 1), sim_plane (grid, 2) };
+
+    for (int y = 0; y < grid->h; y++)
+    {
+        const u8 *row = &grid->tiles[(size_t) y * grid->w];
+
+        for (int word = 0; word < stride; word++)
+        {
+            u64 bits[3] = {0};
+            int x = word * 64;
+            int n = MIN (64, grid->w - x);
+            int b = 0;
+
+            // 8 tiles at a time, then the ragged end of the row one by one
+            for (; b + 8 <= n; b += 8)
+            {
+                u64 v;
+                memcpy (&v, &row[x + b], sizeof (v));
+
+                bits[0] |= sim_bytes_equal (v & 0x0F0F0F0F0F0F0F0Full, TILE_WALL) << b;
+                bits[1] |= sim_bytes_equal (v, TILE_BLOCK | TILE_LIGHT) << b;
+                bits[2] |= sim_bytes_equal (v, TILE_BLOCK | TILE_DARK) << b;
+            }
+
+            for (; b < n; b++)
+            {
+                u8 tile = row[x + b];
+
+                bits[0] |= (u64) (TILE_TYPE (tile) == TILE_WALL) << b;
+                bits[1] |= (u64) (tile == (TILE_BLOCK | TILE_LIGHT)) << b;
+                bits[2] |= (u64) (tile == (TILE_BLOCK | TILE_DARK)) << b;
+            }
+
+            for (int plane = 0; plane < 3; plane++)
+            {
+                planes[plane][(size_t) y * stride + word] = bits[plane];
+            }
+        }
+    }
+}
+
+/*
+ * Bits x0..x1 of a plane's row y, at most 64 of them.
+ */
+static u64
+sim_row_bits (const u64 *plane, int stride, int y, int x0, int x1)
+{
+    const u64 *row = plane + (size_t) y * stride;
+    int n = x1 - x0 + 1;
+    int shift = x0 % 64;
+    u64 bits = row[x0 / 64] >> shift;
+
+    if (shift + n > 64)
+    {
+        bits |= row[x0 / 64 + 1] << (64 - shift);
+    }
+
+    return n == 64 ? bits : bits & ((1ull << n) - 1);
+}
+
+/*
+ * Team rule: a ball bounces off blocks of its own team and flips them to the
+ * other team; blocks of the other team let it through.
+ */
+bool
+sim_tile_hit (struct sim_grid *grid, u32 cell, int team)
+{
+    u8 *tile = &grid->tiles[cell];
+
+    if (TILE_TYPE (*tile) == TILE_BLOCK && TILE_TEAM (*tile) == team)
+    {
+        *tile = TILE_BLOCK | (team == 0x1 ? TILE_DARK : TILE_LIGHT);
+
+        if (grid->occupancy)
+        {
+            sim_occupancy_update (grid, cell);
+        }
+
+        if (grid->flipped && grid->n_flipped < grid->max_flipped)
+        {
+            grid->flipped[grid->n_flipped] = cell;
+        }
+        grid->n_flipped++;
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Time of impact of a circle at c moving by d against the unit tile at
+ * (bx, by), i.e. a ray against the tile grown by r with rounded corners.
+ */
+static bool
+sweep_circle_tile (v2 c, v2 d, float r, float bx, float by, float *t_out, v2 *n_out)
+{
+    v2 closest = v2_clamp (c, (v2) { bx, by }, (v2) { bx + 1.0f, by + 1.0f });
+    v2 diff = v2_sub (c, closest);
+    float dist_sqrd = v2_len_sqrd (diff);
+
+    // already touching: only collide if moving further in
+    if (dist_sqrd < r * r)
+    {
+        v2 n;
+
+        if (dist_sqrd > 0.0f)
+        {
+            n = v2_divf (diff, sqrtf (dist_sqrd));
+        }
+        else
+        {
+            float dx = c.x - (bx + 0.5f);
+            float dy = c.y - (by + 0.5f);
+            n = fabsf (dx) > fabsf (dy) ? (v2) { dx > 0.0f ? 1.0f : -1.0f, 0.0f }
+                                        : (v2) { 0.0f, dy > 0.0f ? 1.0f : -1.0f };
+        }
+
+        if (v2_inner (d, n) < 0.0f)
+        {
+            *t_out = 0.0f;
+            *n_out = n;
+            return true;
+        }
+
+        return false;
+    }
+
+    // slab test against the grown box
+    float origin[2] = { c.x, c.y };
+    float dir[2] = { d.x, d.y };
+    float min[2] = { bx - r, by - r };
+    float max[2] = { bx + 1.0f + r, by + 1.0f + r };
+    float t_enter = 0.0f;
+    float t_exit = 1.0f;
+    int axis = -1;
+
+    for (int a = 0; a < 2; a++)
+    {
+        if (dir[a] == 0.0f)
+        {
+            if (origin[a] < min[a] || origin[a] > max[a])
+            {
+                return false;
+            }
+        }
+        else
+        {
+            float t0 = (min[a] - origin[a]) / dir[a];
+            float t1 = (max[a] - origin[a]) / dir[a];
+
+            if (t0 > t1)
+            {
+                float tmp = t0; t0 = t1; t1 = tmp;
+            }
+
+            if (t0 > t_enter)
+            {
+                t_enter = t0;
+                axis = a;
+            }
+
+            t_exit = MIN (t_exit, t1);
+
+            if (t_enter > t_exit)
+            {
+                return false;
+            }
+        }
+    }
+
+    v2 p = v2_add (c, v2_mulf (d, t_enter));
+    bool out_x = p.x < bx || p.x > bx + 1.0f;
+    bool out_y = p.y < by || p.y > by + 1.0f;
+
+    // corner region: hit the rounded corner instead of the grown box
+    if (out_x && out_y)
+    {
+        v2 corner = { p.x < bx ? bx : bx + 1.0f, p.y < by ? by : by + 1.0f };
+        v2 m = v2_sub (c, corner);
+        float a = v2_inner (d, d);
+        float b = v2_inner (m, d);
+        float disc = b * b - a * (v2_inner (m, m) - r * r);
+
+        if (a == 0.0f || disc < 0.0f)
+        {
+            return false;
+        }
+
+        float t = (-b - sqrtf (disc)) / a;
+        if (t < 0.0f || t > 1.0f)
+        {
+            return false;
+        }
+
+        *t_out = t;
+        *n_out = v2_norm (v2_sub (v2_add (c, v2_mulf (d, t)), corner));
+        return true;
+    }
+
+    if (axis == 0)
+    {
+        *n_out = (v2) { d.x > 0.0f ? -1.0f : 1.0f, 0.0f };
+    }
+    else if (axis == 1)
+    {
+        *n_out = (v2) { 0.0f, d.y > 0.0f ? -1.0f : 1.0f };
+    }
+    else
+    {
+        return false;
+    }
+
+    *t_out = t_enter;
+    return true;
+}
+
+/*
+ * Sweep a ball's centre from c by d through the grid with a DDA walk. Every
+ * tile the ball can touch while its centre is in a cell is within ceil (r)
+ * of that cell, so stopping once the best hit is earlier than the time we
+ * leave the current cell makes the result exact at any speed.
+ */
+bool
+sim_sweep (struct sim_grid *grid, v2 c, v2 d, float r, int team, bool walls, struct sim_hit *hit)
+{
+    int x = (int) floorf (c.x);
+    int y = (int) floorf (c.y);
+    int step_x = d.x > 0.0f ? 1 : -1;
+    int step_y = d.y > 0.0f ? 1 : -1;
+    float t_delta_x = d.x != 0.0f ? fabsf (1.0f / d.x) : INFINITY;
+    float t_delta_y = d.y != 0.0f ? fabsf (1.0f / d.y) : INFINITY;
+    float t_max_x = d.x > 0.0f ? (x + 1 - c.x) * t_delta_x : d.x < 0.0f ? (c.x - x) * t_delta_x : INFINITY;
+    float t_max_y = d.y > 0.0f ? (y + 1 - c.y) * t_delta_y : d.y < 0.0f ? (c.y - y) * t_delta_y : INFINITY;
+    int reach = (int) ceilf (r);
+    bool masked = grid->occupancy && 2 * reach < 64 && (team == 1 || team == 2);
+    int stride = SIM_STRIDE (grid->w);
+    const u64 *wall_plane = masked ? sim_plane (grid, 0) : NULL;
+    const u64 *team_plane = masked ? sim_plane (grid, team) : NULL;
+
+    hit->t = INFINITY;
+    hit->cell = UINT32_MAX;
+
+    /*
+     * The walk below only tests tiles within reach of the cells it visits,
+     * which all lie between the start and end cell (or the one below an end
+     * exactly on a boundary, since t = 1 still steps), so when that
+     * neighbourhood holds no bit it can hit there's no need to walk at all.
+     * That's most sweeps on a map of the other team's blocks.
+     */
+    if (masked)
+    {
+        int bx0 = MAX (0, (int) ceilf (MIN (c.x, c.x + d.x)) - 1 - reach);
+        int bx1 = MIN (grid->w - 1, (int) floorf (MAX (c.x, c.x + d.x)) + reach);
+        int by0 = MAX (0, (int) ceilf (MIN (c.y, c.y + d.y)) - 1 - reach);
+        int by1 = MIN (grid->h - 1, (int) floorf (MAX (c.y, c.y + d.y)) + reach);
+
+        if (bx0 > bx1 || by0 > by1)
+        {
+            return false;
+        }
+
+        if (bx1 - bx0 < 64 && by1 - by0 < 64)
+        {
+            u64 any = 0;
+
+            for (int by = by0; by <= by1 && !any; by++)
+            {
+                any = sim_row_bits (team_plane, stride, by, bx0, bx1);
+                any |= walls ? sim_row_bits (wall_plane, stride, by, bx0, bx1) : 0;
+            }
+
+            if (!any)
+            {
+                return false;
+            }
+        }
+    }
+
+    while (x >= 0 && y >= 0 && x < grid->w && y < grid->h)
+    {
+        int x0 = MAX (0, x - reach);
+        int x1 = MIN (grid->w - 1, x + reach);
+
+        for (int ny = MAX (0, y - reach); masked && ny <= MIN (grid->h - 1, y + reach); ny++)
+        {
+            u64 bits = sim_row_bits (team_plane, stride, ny, x0, x1);
+
+            if (walls)
+            {
+                bits |= sim_row_bits (wall_plane, stride, ny, x0, x1);
+            }
+
+            // only what this ball can hit, in the same order as the scan below
+            while (bits)
+            {
+                unsigned long i;
+                _BitScanForward64 (&i, bits);
+                bits &= bits - 1;
+
+                int nx = x0 + (int) i;
+                u32 cell = ny * grid->w + nx;
+                float t;
+                v2 n;
+
+                if (sweep_circle_tile (c, d, r, nx, ny, &t, &n) && t < hit->t)
+                {
+                    hit->t = t;
+                    hit->normal = n;
+                    hit->cell = cell;
+                }
+            }
+        }
+
+        for (int ny = MAX (0, y - reach); !masked && ny <= MIN (grid->h - 1, y + reach); ny++)
+        {
+            for (int nx = x0; nx <= x1; nx++)
+            {
+                u32 cell = ny * grid->w + nx;
+                float t;
+                v2 n;
+
+                if (sim_tile_solid (grid->tiles[cell], team, walls) &&
+                    sweep_circle_tile (c, d, r, nx, ny, &t, &n) && t < hit->t)
+                {
+                    hit->t = t;
+                    hit->normal = n;
+                    hit->cell = cell;
+                }
+            }
+        }
+
+        float t_leave = MIN (t_max_x, t_max_y);
+        if (hit->t <= t_leave || t_leave > 1.0f)
+        {
+            break;
+        }
+
+        if (t_max_x < t_max_y)
+        {
+            x += step_x;
+            t_max_x += t_delta_x;
+        }
+        else
+        {
+            y += step_y;
+            t_max_y += t_delta_y;
+        }
+    }
+
+    return hit->cell != UINT32_MAX;
+}
+
+/*
+ * Move one ball for dt, bouncing off walls and own-team blocks. Returns the
+ * number of blocks it flipped.
+ */
+u32
+sim_move_ball (struct sim_grid *grid, v2 *centre, v2 *velocity, float r, int team, float dt)
+{
+    u32 flips = 0;
+    v2 c = *centre;
+    v2 v = *velocity;
+    float remaining = 1.0f;
+
+    for (int bounce = 0; bounce < SIM_MAX_BOUNCES && remaining > 0.0f; bounce++)
+    {
+        v2 delta = v2_mulf (v, dt * remaining);
+        struct sim_hit hit;
+
+        if (sim_sweep (grid, c, delta, r, team, true, &hit))
+        {
+            c = v2_add (c, v2_mulf (delta, hit.t));
+            c = v2_add (c, v2_mulf (hit.normal, SIM_SKIN));
+            v = v2_reflect (v, hit.normal);
+            flips += sim_tile_hit (grid, hit.cell, team);
+            remaining *= 1.0f - hit.t;
+        }
+        else
+        {
+            c = v2_add (c, delta);
+            remaining = 0.0f;
+        }
+    }
+
+    *centre = c;
+    *velocity = v;
+
+    return flips;
+}
+
+/*
+ * Batched environments
+ */
+struct sim_worker
+{
+    struct sim_batch *batch;
+    HANDLE start;
+    HANDLE thread;
+};
+
+struct sim_batch
+{
+    int n_envs;
+    int n_balls;
+    int w, h;
+    struct sim_buffers buffers;
+
+    u8 *tiles;      // the map with PLAYER cells turned into blocks
+    v2 *spawn;      // n_balls
+    u8 *ball_team;  // n_balls
+    u64 *rng;       // n_envs
+    u64 *occupancy; // n_envs * sim_occupancy_size (), see sim_grid
+
+    // current sim_step_batch () job
+    int n_steps;
+    float dt;
+    volatile LONG next_env;
+    volatile LONG busy;
+    HANDLE done;
+
+    volatile bool quit;
+    int n_workers;
+    struct sim_worker workers[SIM_MAX_WORKERS];
+};
+
+static u64
+splitmix64 (u64 *state)
+{
+    u64 z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static float
+sim_randf (u64 *state, float min, float max)
+{
+    float r = (float) (splitmix64 (state) >> 40) / (float) (1 << 24);
+    return r * (max - min) + min;
+}
+
+int
+sim_ball_count (const struct level *map)
+{
+    int n = 0;
+
+    for (int i = 0; i < map->w * map->h; i++)
+    {
+        n += TILE_TYPE (map->cells[i]) == TILE_PLAYER;
+    }
+
+    return n;
+}
+
+static struct sim_grid
+sim_env_grid (struct sim_batch *batch, int env)
+{
+    size_t n_tiles = (size_t) batch->w * batch->h;
+
+    return (struct sim_grid) {
+        .w = batch->w,
+        .h = batch->h,
+        .tiles = batch->buffers.tiles + env * n_tiles,
+        .occupancy = batch->occupancy + env * sim_occupancy_size (batch->w, batch->h) / sizeof (u64),
+    };
+}
+
+static void
+sim_reset_env (struct sim_batch *batch, int env, u64 seed)
+{
+    size_t n_tiles = (size_t) batch->w * batch->h;
+    v2 *pos = (v2 *) batch->buffers.ball_pos + (size_t) env * batch->n_balls;
+    v2 *vel = (v2 *) batch->buffers.ball_vel + (size_t) env * batch->n_balls;
+
+    batch->rng[env] = seed;
+    memcpy (batch->buffers.tiles + env * n_tiles, batch->tiles, n_tiles);
+
+    struct sim_grid grid = sim_env_grid (batch, env);
+    sim_occupancy_build (&grid);
+
+    for (int i = 0; i < batch->n_balls; i++)
+    {
+        pos[i] = batch->spawn[i];
+        vel[i].x = sim_randf (&batch->rng[env], -10.0f, 10.0f);
+        vel[i].y = sim_randf (&batch->rng[env], -10.0f, 10.0f);
+    }
+
+    if (batch->buffers.flips)
+    {
+        batch->buffers.flips[env] = 0;
+    }
+}
+
+static void
+sim_step_env (struct sim_batch *batch, int env)
+{
+    struct sim_grid grid = sim_env_grid (batch, env);
+    v2 *pos = (v2 *) batch->buffers.ball_pos + (size_t) env * batch->n_balls;
+    v2 *vel = (v2 *) batch->buffers.ball_vel + (size_t) env * batch->n_balls;
+    u64 flips = 0;
+
+    for (int step = 0; step < batch->n_steps; step++)
+    {
+        for (int i = 0; i < batch->n_balls; i++)
+        {
+            flips += sim_move_ball (&grid, &pos[i], &vel[i], 0.5f, batch->ball_team[i], batch->dt);
+        }
+    }
+
+    if (batch->buffers.flips)
+    {
+        batch->buffers.flips[env] += flips;
+    }
+}
+
+static void
+sim_run_job (struct sim_batch *batch)
+{
+    for (;;)
+    {
+        LONG first = InterlockedExchangeAdd (&batch->next_env, SIM_ENV_GRAIN);
+
+        if (first >= batch->n_envs)
+        {
+            break;
+        }
+
+        for (int env = first; env < MIN (first + SIM_ENV_GRAIN, batch->n_envs); env++)
+        {
+            sim_step_env (batch, env);
+        }
+    }
+}
+
+static DWORD WINAPI
+sim_worker_thread (void *param)
+{
+    struct sim_worker *worker = param;
+    struct sim_batch *batch = worker->batch;
+
+    for (;;)
+    {
+        WaitForSingleObject (worker->start, INFINITE);
+
+        if (batch->quit)
+        {
+            break;
+        }
+
+        sim_run_job (batch);
+
+        if (InterlockedDecrement (&batch->busy) == 0)
+        {
+            SetEvent (batch->done);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * One allocation for the batch and its per-map tables; the per-env state is
+ * the caller's buffers.
+ */
+struct sim_batch *
+sim_create (int n_envs, const struct level *map, const u64 *seeds, struct sim_buffers buffers)
+{
+    int n_balls = sim_ball_count (map);
+    size_t n_tiles = (size_t) map->w * map->h;
+    struct arena arena;
+
+    arena_init (&arena, sizeof (struct sim_batch) + n_tiles + n_balls * (sizeof (v2) + 1) +
+                        n_envs * (sizeof (u64) + sim_occupancy_size (map->w, map->h)) + 6 * ARENA_ALIGN);
+
+    struct sim_batch *batch = ARENA_PUSH_ARRAY (&arena, struct sim_batch, 1);
+    batch->n_envs = n_envs;
+    batch->n_balls = n_balls;
+    batch->w = map->w;
+    batch->h = map->h;
+    batch->buffers = buffers;
+    batch->tiles = ARENA_PUSH_ARRAY (&arena, u8, n_tiles);
+    batch->spawn = ARENA_PUSH_ARRAY (&arena, v2, n_balls);
+    batch->ball_team = ARENA_PUSH_ARRAY (&arena, u8, n_balls);
+    batch->rng = ARENA_PUSH_ARRAY (&arena, u64, n_envs);
+    batch->occupancy = ARENA_PUSH_ARRAY (&arena, u64, n_envs * sim_occupancy_size (map->w, map->h) / sizeof (u64));
+
+    ASSERT ((u8 *) batch == arena.base);
+
+    int ball = 0;
+    for (int y = 0; y < map->h; y++)
+    {
+        for (int x = 0; x < map->w; x++)
+        {
+            u8 cell = map->cells[y * map->w + x];
+
+            switch (TILE_TYPE (cell))
+            {
+                case TILE_WALL:
+                    batch->tiles[y * map->w + x] = TILE_WALL;
+                    break;
+                case TILE_BLOCK:
+                    batch->tiles[y * map->w + x] = cell;
+                    break;
+                case TILE_PLAYER:
+                    batch->tiles[y * map->w + x] = TILE_BLOCK | (TILE_TEAM (cell) == 0x1 ? TILE_DARK : TILE_LIGHT);
+                    batch->spawn[ball] = (v2) { x + 0.5f, y + 0.5f };
+                    batch->ball_team[ball] = TILE_TEAM (cell);
+                    ball++;
+                    break;
+            }
+        }
+    }
+
+    for (int env = 0; env < n_envs; env++)
+    {
+        sim_reset_env (batch, env, seeds ? seeds[env] : (u64) env);
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo (&info);
+
+    batch->done = CreateEventA (NULL, FALSE, FALSE, NULL);
+    batch->n_workers = MIN ((int) info.dwNumberOfProcessors - 1, SIM_MAX_WORKERS);
+    batch->n_workers = MIN (batch->n_workers, (n_envs + SIM_ENV_GRAIN - 1) / SIM_ENV_GRAIN - 1);
+    batch->n_workers = MAX (batch->n_workers, 0);
+
+    for (int i = 0; i < batch->n_workers; i++)
+    {
+        struct sim_worker *worker = &batch->workers[i];
+
+        worker->batch = batch;
+        worker->start = CreateEventA (NULL, FALSE, FALSE, NULL);
+        worker->thread = CreateThread (NULL, 0, sim_worker_thread, worker, 0, NULL);
+    }
+
+    return batch;
+}
+
+/*
+ * Reset the environments with a non-zero mask entry (all of them when mask
+ * is NULL) to the start of the map with a new seed. Without seeds each env
+ * draws its next one from its own generator.
+ */
+void
+sim_reset (struct sim_batch *batch, const u8 *mask, const u64 *seeds)
+{
+    for (int env = 0; env < batch->n_envs; env++)
+    {
+        if (!mask || mask[env])
+        {
+            sim_reset_env (batch, env, seeds ? seeds[env] : splitmix64 (&batch->rng[env]));
+        }
+    }
+}
+
+/*
+ * Advance every environment n_steps ticks of dt, spread over all cores. The
+ * calling thread takes a share of the work and returns when all of it is done.
+ */
+void
+sim_step_batch (struct sim_batch *batch, int n_steps, float dt)
+{
+    batch->n_steps = n_steps;
+    batch->dt = dt;
+    batch->next_env = 0;
+    batch->busy = batch->n_workers + 1;
+
+    for (int i = 0; i < batch->n_workers; i++)
+    {
+        SetEvent (batch->workers[i].start);
+    }
+
+    sim_run_job (batch);
+
+    if (InterlockedDecrement (&batch->busy) != 0)
+    {
+        WaitForSingleObject (batch->done, INFINITE);
+    }
+}
+
+void
+sim_destroy (struct sim_batch *batch)
+{
+    batch->quit = true;
+
+    for (int i = 0; i < batch->n_workers; i++)
+    {
+        SetEvent (batch->workers[i].start);
+        WaitForSingleObject (batch->workers[i].thread, INFINITE);
+        CloseHandle (batch->workers[i].thread);
+        CloseHandle (batch->workers[i].start);
+    }
+
+    CloseHandle (batch->done);
+    heap_free (batch);
+}
@@ -0,0 +1,96 @@
+#ifndef _SIM_
+#define _SIM_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "util.h"
+#include "vector2.h"
+#include "level.h"
+
+/*
+ * Grid simulation, shared by the game's grid backend and the batched
+ * environment API below. Ball positions here are centres, in tiles.
+ */
+
+#define SIM_SKIN        1e-4f // gap left between a ball and the tile it bounced off
+#define SIM_MAX_BOUNCES 4     // per ball, per tick
+
+#if defined (SIM_DLL)
+#define SIM_API __declspec (dllexport)
+#else
+#define SIM_API
+#endif
+
+/*
+ * occupancy is optional: one bit per tile in three planes, walls and the
+ * blocks of each team, SIM_STRIDE (w) words per row. A ball can only hit
+ * walls and its own team's blocks, so with it a sweep looks at just those
+ * bits and everything else costs nothing. Whoever writes tiles other than
+ * through sim_tile_hit () calls sim_occupancy_update () or _build ().
+ *
+ * flipped is an optional log of the cells sim_tile_hit () flipped. Only
+ * max_flipped are stored but n_flipped counts every one, so the caller can
+ * tell when the log overflowed.
+ */
+#define SIM_STRIDE(__w) (((__w) + 63) >> 6)
+
+struct sim_grid
+{
+    int w, h;
+    u8 *tiles; // live tiles, WALL or BLOCK | team
+    u64 *occupancy; // sim_occupancy_size () bytes
+
+    u32 *flipped;
+    u32 n_flipped;
+    u32 max_flipped;
+};
+
+struct sim_hit
+{
+    float t; // fraction of the swept motion
+    v2 normal;
+    u32 cell;
+};
+
+SIM_API size_t sim_occupancy_size (int w, int h);
+SIM_API void sim_occupancy_build (struct sim_grid *grid);
+SIM_API void sim_occupancy_update (struct sim_grid *grid, u32 cell);
+SIM_API bool sim_tile_solid (u8 tile, int team, bool walls);
+SIM_API bool sim_tile_hit (struct sim_grid *grid, u32 cell, int team);
+SIM_API bool sim_sweep (struct sim_grid *grid, v2 c, v2 d, float r, int team, bool walls, struct sim_hit *hit);
+SIM_API u32 sim_move_ball (struct sim_grid *grid, v2 *centre, v2 *velocity, float r, int team, float dt);
+
+/*
+ * Batched environments. Every environment plays the same map with its own
+ * seed. The caller owns the state buffers, laid out env-major and
+ * contiguous; stepping writes straight into them, so reading an observation
+ * is just reading the buffer:
+ *
+ *   ball_pos  n_envs * n_balls * 2 floats, ball centres
+ *   ball_vel  n_envs * n_balls * 2 floats, tiles per second
+ *   tiles     n_envs * w * h bytes, live tiles (see level.h)
+ *   flips     n_envs counters, optional
+ *
+ * Use sim_ball_count () to size the ball buffers for a map. seeds may be
+ * NULL, environments are then seeded by index. The tiles are read-only to
+ * the caller, the batch keeps occupancy bitmaps in step with them.
+ */
+struct sim_buffers
+{
+    float *ball_pos;
+    float *ball_vel;
+    u8 *tiles;
+    u64 *flips;
+};
+
+struct sim_batch;
+
+SIM_API int sim_ball_count (const struct level *map);
+SIM_API struct sim_batch *sim_create (int n_envs, const struct level *map, const u64 *seeds, struct sim_buffers buffers);
+SIM_API void sim_reset (struct sim_batch *batch, const u8 *mask, const u64 *seeds);
+SIM_API void sim_step_batch (struct sim_batch *batch, int n_steps, float dt);
+SIM_API void sim_destroy (struct sim_batch *batch);
+
+#endif
@@ -68,6 +68,17 @@ v2_clamp (v2 v, v2 min, v2 max)
     return result;
 }
 
+inline v2
+v2_mulf (v2 a, float f)
+{
+    v2 result;
+
+    result.x = a.x * f;
+    result.y = a.y * f;
+
+    return result;
+}
+
 inline v2
 v2_divf (v2 a, float f)
 {
@@ -115,6 +126,19 @@ v2_norm (v2 a)
     return result;
 }
 
+// reflect a about the unit normal n
+inline v2
+v2_reflect (v2 a, v2 n)
+{
+    float d = 2.0f * v2_inner (a, n);
+    v2 result;
+
+    result.x = a.x - d * n.x;
+    result.y = a.y - d * n.y;
+
+    return result;
+}
+
 inline bool
 v2_eq (v2 a, v2 b)
 {
@@ -137,7 +161,9 @@ v2_test (void)
     ASSERT (v2_eq (v2_addf (a, 1.4f), (v2) { 3.4f, 4.4f }));
     ASSERT (v2_eq (v2_neg (a), (v2) { -2.0f, -3.0f }));
     ASSERT (v2_eq (v2_clamp (b, v2_neg (a), c), c));
+    ASSERT (v2_eq (v2_mulf (a, 2.0f), (v2) { 4.0f, 6.0f }));
     ASSERT (v2_eq (v2_divf (a, 2.0f), (v2) { 1.0f, 1.5f }));
+    ASSERT (v2_eq (v2_reflect (a, (v2) { 0.0f, 1.0f }), (v2) { 2.0f, -3.0f }));
     ASSERT (v2_inner (a, c) == 21.0f);
     ASSERT (v2_len_sqrd (a) == 13.0f);
     ASSERT (v2_len (a) == 3.60555127546f);